@@ -10,14 +10,16 @@ if [ $? -ne 0 ]; then
 fi
 
 # Function to run the program against a test case, checking
-# its output and exit status against what's expected.
+# its output and exit status against what's expected.  An optional
+# third argument gives options for the program.
 runtest() {
   TEST_NO=$1
   EX_STATUS=$2
+  OPTS=$3
   LOCALFAIL=0
 
   rm -f output.txt
-  ./comments < c_input_$TEST_NO.txt > output.txt
+  ./comments $OPTS < c_input_$TEST_NO.txt > output.txt
   STATUS=$?
 
   if [ $STATUS -ne $EX_STATUS ]; then
@@ -46,6 +48,119 @@ runtest 3 0
 runtest 4 0
 runtest 5 101
 runtest 6 100
+runtest 7 0 "-x"
+runtest 8 0 "-s"
+
+# Function to check the cache file.  The test's input is counted twice
+# with -p, and the second run should get every file from the cache.
+# Then a copy of the input is counted and removed, and the next run
+# should prune its record, leaving the cache as it was.
+runcache() {
+  TEST_NO=$1
+  LOCALFAIL=0
+
+  rm -f output.txt cache.bin stale_$TEST_NO.txt
+  ./comments -c cache.bin c_input_$TEST_NO.txt c_input_1.txt > /dev/null
+  ./comments -p -c cache.bin c_input_$TEST_NO.txt c_input_1.txt \
+    > output.txt 2> stderr.txt
+  STATUS=$?
+  grep "^Files:" stderr.txt >> output.txt
+
+  if [ $STATUS -ne 0 ]; then
+    echo "**** Test $TEST_NO FAILED - incorrect exit status. Expected: 0 Got: $STATUS"
+    FAIL=1
+    LOCALFAIL=1
+  fi
+
+  DIFFREPORT=$(diff -q c_expected_$TEST_NO.txt output.txt)
+  if [ $? -ne 0 ]
+  then
+    echo "**** Test $TEST_NO FAILED - program output didn't match expected output: $DIFFREPORT"
+    FAIL=1
+    LOCALFAIL=1
+  fi
+
+  cp cache.bin cache_before.bin
+  cp c_input_$TEST_NO.txt stale_$TEST_NO.txt
+  ./comments -c cache.bin c_input_$TEST_NO.txt stale_$TEST_NO.txt > /dev/null
+  rm -f stale_$TEST_NO.txt
+  ./comments -c cache.bin c_input_$TEST_NO.txt c_input_1.txt > /dev/null
+
+  if ! cmp -s cache_before.bin cache.bin; then
+    echo "**** Test $TEST_NO FAILED - cache kept the record for a removed file"
+    FAIL=1
+    LOCALFAIL=1
+  fi
+
+  if [ $LOCALFAIL -eq 0 ]; then
+    echo "Test $TEST_NO PASS"
+  fi
+
+  rm -f cache.bin cache_before.bin stderr.txt
+}
+
+runcache 9
+
+# Function to get one report from the watch mode socket.
+report() {
+  perl -MIO::Socket::UNIX -e \
+    '$s = IO::Socket::UNIX->new( Peer => $ARGV[ 0 ] ) or exit 1; print <$s>' \
+    watch.sock
+}
+
+# Function to check watch mode.  It watches a directory and a file named
+# on the command line, reports the totals, then edits the named file,
+# replaces one file in the directory and removes another, and reports
+# the totals again.
+runwatch() {
+  TEST_NO=$1
+  LOCALFAIL=0
+
+  rm -rf output.txt watch.sock watch_dir watch_file.txt
+  mkdir watch_dir
+  cp c_input_1.txt watch_dir/a.c
+  cp c_input_2.txt watch_dir/b.c
+  cp c_input_$TEST_NO.txt watch_file.txt
+
+  ./comments -w watch.sock watch_dir watch_file.txt &
+  PID=$!
+  for i in $(seq 50); do
+    [ -S watch.sock ] && break
+    sleep 0.1
+  done
+
+  report > output.txt
+  cp c_input_3.txt watch_file.txt
+  cp c_input_4.txt watch_dir/a.c
+  rm watch_dir/b.c
+  report >> output.txt
+
+  kill -TERM $PID
+  wait $PID
+  STATUS=$?
+
+  if [ $STATUS -ne 0 ]; then
+    echo "**** Test $TEST_NO FAILED - incorrect exit status. Expected: 0 Got: $STATUS"
+    FAIL=1
+    LOCALFAIL=1
+  fi
+
+  DIFFREPORT=$(diff -q c_expected_$TEST_NO.txt output.txt)
+  if [ $? -ne 0 ]
+  then
+    echo "**** Test $TEST_NO FAILED - program output didn't match expected output: $DIFFREPORT"
+    FAIL=1
+    LOCALFAIL=1
+  fi
+
+  if [ $LOCALFAIL -eq 0 ]; then
+    echo "Test $TEST_NO PASS"
+  fi
+
+  rm -rf watch.sock watch_dir watch_file.txt
+}
+
+runwatch 10
 
 if [ $FAIL -ne 0 ]; then
   echo "FAILING TESTS!"
@@ -0,0 +1,461 @@
+/**
+  @file cache.c
+  @author Jesse Liddle (jaliddl2)
+
+  Implementation of the persistent comment statistics cache.  Records on
+  disk use the byte order of the machine that wrote them; a cache moved
+  to a different kind of machine just fails the magic check and is
+  rebuilt.
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include "cache.h"
+#include "scanner.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Magic number at the start of a cache file ("CMTC").
+#define CACHE_MAGIC 0x43544d43u
+
+// Version of the cache file layout.
+#define CACHE_VERSION 1u
+
+// Initial capacity of the list of updated records.
+#define INITIAL_CAPACITY 16
+
+// Flag bit for a file that ends inside a comment.
+#define FLAG_UNTERMINATED 1u
+
+/** Header at the start of a cache file. */
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  // Number of records that follow the header.
+  uint64_t count;
+} DiskHeader;
+
+/** Layout of one record in the cache file. */
+typedef struct {
+  int64_t size;
+  int64_t mtimeSec;
+  int64_t mtimeNsec;
+  uint64_t hash;
+  int64_t totalChars;
+  int64_t commentChars;
+  int64_t commentCount;
+  // Location of the path in the string table after the records.
+  uint32_t pathOffset;
+  uint32_t pathLen;
+  uint64_t flags;
+} DiskRecord;
+
+/** A record added during this run, along with its path. */
+typedef struct {
+  char *path;
+  CacheRecord rec;
+} Update;
+
+struct CacheTag {
+  // The mapped cache file, or NULL if there wasn't a valid one.
+  void *map;
+  size_t mapLen;
+  // Records and path strings inside the mapping.
+  const DiskRecord *records;
+  size_t count;
+  const char *strings;
+  // One flag for each record in the mapping, set once it is looked up.
+  unsigned char *used;
+  // Records added with updateCache().
+  Update *updates;
+  size_t updateCount;
+  size_t updateCap;
+};
+
+/**
+  Compares a path with the path of a record in the mapped file.
+
+  @param cache the cache holding the record.
+  @param path the path to compare.
+  @param len length of the path.
+  @param r the record to compare against.
+  @return negative, zero or positive like strcmp.
+*/
+static int comparePath( Cache *cache, const char *path, size_t len,
+                        const DiskRecord *r )
+{
+  size_t n = len < r->pathLen ? len : r->pathLen;
+  int c = memcmp( path, cache->strings + r->pathOffset, n );
+  if ( c != 0 )
+    return c;
+  return ( len > r->pathLen ) - ( len < r->pathLen );
+}
+
+Cache *loadCache( const char *path )
+{
+  Cache *cache = (Cache *) calloc( 1, sizeof( Cache ) );
+  if ( cache == NULL )
+    return NULL;
+
+  int fd = open( path, O_RDONLY );
+  if ( fd < 0 )
+    return cache;
+
+  struct stat st;
+  if ( fstat( fd, &st ) != 0 || st.st_size < (off_t) sizeof( DiskHeader ) ) {
+    close( fd );
+    return cache;
+  }
+
+  size_t len = st.st_size;
+  void *map = mmap( NULL, len, PROT_READ, MAP_PRIVATE, fd, 0 );
+  close( fd );
+  if ( map == MAP_FAILED )
+    return cache;
+
+  // Check the header and make sure every record's path is inside the file.
+  const DiskHeader *head = (const DiskHeader *) map;
+  size_t room = ( len - sizeof( DiskHeader ) ) / sizeof( DiskRecord );
+  bool valid = head->magic == CACHE_MAGIC && head->version == CACHE_VERSION
+    && head->count <= room;
+  if ( valid ) {
+    const DiskRecord *records = (const DiskRecord *) ( head + 1 );
+    size_t strLen = len - sizeof( DiskHeader ) - head->count * sizeof( DiskRecord );
+    for ( size_t i = 0; valid && i < head->count; i++ )
+      valid = (size_t) records[ i ].pathOffset + records[ i ].pathLen <= strLen;
+  }
+
+  if ( !valid ) {
+    munmap( map, len );
+    return cache;
+  }
+
+  cache->used = (unsigned char *) calloc( head->count ? head->count : 1, 1 );
+  if ( cache->used == NULL ) {
+    munmap( map, len );
+    return cache;
+  }
+
+  cache->map = map;
+  cache->mapLen = len;
+  cache->records = (const DiskRecord *) ( head + 1 );
+  cache->count = head->count;
+  cache->strings = (const char *) ( cache->records + cache->count );
+  return cache;
+}
+
+bool lookupCache( Cache *cache, const char *path, CacheRecord *rec )
+{
+  size_t len = strlen( path );
+
+  // Records are sorted by path, so this is a binary search of the mapping.
+  size_t lo = 0;
+  size_t hi = cache->count;
+  while ( lo < hi ) {
+    size_t mid = lo + ( hi - lo ) / 2;
+    const DiskRecord *r = cache->records + mid;
+    int c = comparePath( cache, path, len, r );
+    if ( c == 0 ) {
+      cache->used[ mid ] = 1;
+      rec->size = r->size;
+      rec->mtimeSec = r->mtimeSec;
+      rec->mtimeNsec = r->mtimeNsec;
+      rec->hash = r->hash;
+      rec->totalChars = r->totalChars;
+      rec->commentChars = r->commentChars;
+      rec->commentCount = r->commentCount;
+      rec->unterminated = ( r->flags & FLAG_UNTERMINATED ) != 0;
+      return true;
+    }
+    if ( c < 0 )
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+
+  return false;
+}
+
+void updateCache( Cache *cache, const char *path, const CacheRecord *rec )
+{
+  // If there's no memory for the update, the file is just scanned
+  // again next time.
+  if ( cache->updateCount >= cache->updateCap ) {
+    size_t cap = cache->updateCap ? cache->updateCap * 2 : INITIAL_CAPACITY;
+    Update *updates = (Update *) realloc( cache->updates, cap * sizeof( Update ) );
+    if ( updates == NULL )
+      return;
+    cache->updates = updates;
+    cache->updateCap = cap;
+  }
+
+  char *copy = strdup( path );
+  if ( copy == NULL )
+    return;
+
+  Update *u = cache->updates + cache->updateCount++;
+  u->path = copy;
+  u->rec = *rec;
+}
+
+/**
+  Orders updates by path, for qsort.
+*/
+static int compareUpdates( const void *a, const void *b )
+{
+  return strcmp( ( (const Update *) a )->path, ( (const Update *) b )->path );
+}
+
+/**
+  Tells if an old record should be dropped when the cache is saved,
+  because its file is gone.  Records looked up in this run are kept
+  without checking, so a run over the same tree adds no work, and other
+  records are only kept while their path still exists.
+
+  @param cache the cache holding the record.
+  @param i the index of the record.
+  @return true if the record should be dropped.
+*/
+static bool staleRecord( Cache *cache, size_t i )
+{
+  if ( cache->used[ i ] )
+    return false;
+
+  const DiskRecord *r = cache->records + i;
+  char *path = (char *) malloc( r->pathLen + 1 );
+  if ( path == NULL )
+    return false;
+  memcpy( path, cache->strings + r->pathOffset, r->pathLen );
+  path[ r->pathLen ] = '\0';
+  struct stat st;
+  bool gone = lstat( path, &st ) != 0;
+  free( path );
+  return gone;
+}
+
+/**
+  Fills in a disk record from a record in memory.
+
+  @param d the disk record to fill in.
+  @param rec the record to copy.
+  @param offset location of the path in the string table.
+  @param len length of the path.
+*/
+static void makeDiskRecord( DiskRecord *d, const CacheRecord *rec,
+                            size_t offset, size_t len )
+{
+  d->size = rec->size;
+  d->mtimeSec = rec->mtimeSec;
+  d->mtimeNsec = rec->mtimeNsec;
+  d->hash = rec->hash;
+  d->totalChars = rec->totalChars;
+  d->commentChars = rec->commentChars;
+  d->commentCount = rec->commentCount;
+  d->pathOffset = offset;
+  d->pathLen = len;
+  d->flags = rec->unterminated ? FLAG_UNTERMINATED : 0;
+}
+
+bool saveCache( Cache *cache, const char *path )
+{
+  // Sort the updates and drop duplicates of the same path.
+  if ( cache->updateCount > 1 )
+    qsort( cache->updates, cache->updateCount, sizeof( Update ), compareUpdates );
+  size_t unique = 0;
+  for ( size_t i = 0; i < cache->updateCount; i++ ) {
+    if ( unique > 0 && strcmp( cache->updates[ unique - 1 ].path,
+                               cache->updates[ i ].path ) == 0 ) {
+      free( cache->updates[ unique - 1 ].path );
+      cache->updates[ unique - 1 ] = cache->updates[ i ];
+    } else {
+      cache->updates[ unique++ ] = cache->updates[ i ];
+    }
+  }
+  cache->updateCount = unique;
+
+  // Merge the old records with the updates, both already in path order.
+  size_t cap = cache->count + cache->updateCount;
+  DiskRecord *records = (DiskRecord *) malloc( ( cap ? cap : 1 ) * sizeof( DiskRecord ) );
+  size_t strCap = 64;
+  size_t strLen = 0;
+  char *strings = (char *) malloc( strCap );
+  if ( records == NULL || strings == NULL ) {
+    free( strings );
+    free( records );
+    return false;
+  }
+  size_t n = 0;
+  size_t i = 0;
+  size_t j = 0;
+
+  while ( i < cache->count || j < cache->updateCount ) {
+    const char *p;
+    size_t len;
+    int c;
+    if ( j >= cache->updateCount ) {
+      c = -1;
+    } else if ( i >= cache->count ) {
+      c = 1;
+    } else {
+      c = -comparePath( cache, cache->updates[ j ].path,
+                        strlen( cache->updates[ j ].path ), cache->records + i );
+    }
+
+    // Records for files that were removed are pruned, so the cache
+    // doesn't keep growing over the life of a tree
+    if ( c < 0 && staleRecord( cache, i ) ) {
+      i++;
+      continue;
+    }
+
+    if ( c < 0 ) {
+      p = cache->strings + cache->records[ i ].pathOffset;
+      len = cache->records[ i ].pathLen;
+    } else {
+      p = cache->updates[ j ].path;
+      len = strlen( p );
+    }
+
+    while ( strLen + len > strCap ) {
+      strCap *= 2;
+      char *grown = (char *) realloc( strings, strCap );
+      if ( grown == NULL ) {
+        free( strings );
+        free( records );
+        return false;
+      }
+      strings = grown;
+    }
+    memcpy( strings + strLen, p, len );
+
+    if ( c < 0 ) {
+      records[ n ] = cache->records[ i++ ];
+      records[ n ].pathOffset = strLen;
+    } else {
+      makeDiskRecord( records + n, &cache->updates[ j++ ].rec, strLen, len );
+      // An update replaces the old record for the same path.
+      if ( c == 0 )
+        i++;
+    }
+    strLen += len;
+    n++;
+  }
+
+  // Write everything to a temporary file, then rename it over the old one.
+  size_t tmpLen = strlen( path ) + 5;
+  char *tmp = (char *) malloc( tmpLen );
+  if ( tmp == NULL ) {
+    free( strings );
+    free( records );
+    return false;
+  }
+  snprintf( tmp, tmpLen, "%s.tmp", path );
+
+  bool ok = false;
+  FILE *fp = fopen( tmp, "wb" );
+  if ( fp ) {
+    DiskHeader head = { CACHE_MAGIC, CACHE_VERSION, n };
+    ok = fwrite( &head, sizeof( head ), 1, fp ) == 1
+      && fwrite( records, sizeof( DiskRecord ), n, fp ) == n
+      && fwrite( strings, 1, strLen, fp ) == strLen;
+    ok = fclose( fp ) == 0 && ok;
+    ok = ok && rename( tmp, path ) == 0;
+    if ( !ok )
+      remove( tmp );
+  }
+
+  free( tmp );
+  free( strings );
+  free( records );
+  return ok;
+}
+
+void freeCache( Cache *cache )
+{
+  if ( cache->map )
+    munmap( cache->map, cache->mapLen );
+  free( cache->used );
+  for ( size_t i = 0; i < cache->updateCount; i++ )
+    free( cache->updates[ i ].path );
+  free( cache->updates );
+  free( cache );
+}
+
+bool cachedFileStats( Cache *cache, const char *path, const struct stat *st,
+                      CacheRecord *rec, bool *hit )
+{
+  CacheRecord old;
+  bool found = cache && lookupCache( cache, path, &old ) && old.size == st->st_size;
+  *hit = found && old.mtimeSec == st->st_mtim.tv_sec
+    && old.mtimeNsec == st->st_mtim.tv_nsec;
+  if ( *hit ) {
+    *rec = old;
+    return true;
+  }
+
+  int fd = open( path, O_RDONLY );
+  if ( fd < 0 )
+    return false;
+
+  size_t len = st->st_size;
+  const char *map = NULL;
+  if ( len > 0 ) {
+    map = mmap( NULL, len, PROT_READ, MAP_PRIVATE, fd, 0 );
+    if ( map == MAP_FAILED ) {
+      close( fd );
+      return false;
+    }
+  }
+  close( fd );
+
+  // Hash only when there's a record to compare with or a cache to
+  // store into, so counting without a cache is a single pass.
+  uint64_t hash = found ? hashContents( map, len ) : 0;
+  if ( found && old.hash == hash ) {
+    // Only the timestamp changed, so the old counts are still good.
+    *rec = old;
+    *hit = true;
+  } else {
+    CommentScanner s;
+    rec->unterminated = !scanBuffer( &s, map, len, NULL, NULL );
+    rec->totalChars = s.totalChars;
+    rec->commentChars = s.commentChars;
+    rec->commentCount = s.commentCount;
+    rec->hash = found || !cache ? hash : hashContents( map, len );
+  }
+
+  if ( len > 0 )
+    munmap( (void *) map, len );
+
+  rec->size = st->st_size;
+  rec->mtimeSec = st->st_mtim.tv_sec;
+  rec->mtimeNsec = st->st_mtim.tv_nsec;
+  if ( cache )
+    updateCache( cache, path, rec );
+  return true;
+}
+
+uint64_t hashContents( const char *buf, size_t len )
+{
+  const uint64_t mult = 0x9e3779b97f4a7c15ull;
+  uint64_t h = len * mult;
+  size_t i = 0;
+
+  for ( ; i + sizeof( uint64_t ) <= len; i += sizeof( uint64_t ) ) {
+    uint64_t w;
+    memcpy( &w, buf + i, sizeof( w ) );
+    h = ( h ^ w ) * mult;
+    h ^= h >> 29;
+  }
+
+  uint64_t w = 0;
+  if ( len > i )
+    memcpy( &w, buf + i, len - i );
+  h = ( h ^ w ) * mult;
+  h ^= h >> 32;
+  return h;
+}
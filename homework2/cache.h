@@ -0,0 +1,123 @@
+/**
+  @file cache.h
+  @author Jesse Liddle (jaliddl2)
+
+  Persistent cache of per-file comment statistics.  The cache file is a
+  small header followed by an array of fixed-size records sorted by path
+  and a table holding the path strings.  It is loaded with a single mmap
+  and searched in place, so loading costs nothing beyond the page faults
+  for the records that are actually looked at.
+*/
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/**
+  The statistics stored for one file along with the key used to decide
+  whether they are still valid.
+*/
+typedef struct {
+  // Size of the file in bytes when it was scanned.
+  int64_t size;
+  // Modification time of the file when it was scanned.
+  int64_t mtimeSec;
+  int64_t mtimeNsec;
+  // Hash of the contents of the file, from hashContents().
+  uint64_t hash;
+  // Comment statistics for the file.
+  int64_t totalChars;
+  int64_t commentChars;
+  int64_t commentCount;
+  // True if the file ends inside a comment.
+  bool unterminated;
+} CacheRecord;
+
+/**
+  Short typename for the cache.  Its representation is private to cache.c.
+*/
+typedef struct CacheTag Cache;
+
+/**
+  Loads the cache stored in the given file.  A missing, truncated or
+  otherwise invalid file gives an empty cache, since everything can
+  always be recomputed.
+
+  @param path name of the cache file.
+  @return a new cache, or NULL if there's no memory for one.  The caller
+          must free it with freeCache().
+*/
+Cache *loadCache( const char *path );
+
+/**
+  Looks up the record stored for the given path.
+
+  @param cache the cache to search.
+  @param path the path of the file, exactly as it was given to updateCache().
+  @param rec filled in with the record if one is found.
+  @return true if the cache has a record for the path.
+*/
+bool lookupCache( Cache *cache, const char *path, CacheRecord *rec );
+
+/**
+  Stores a new record for the given path.  The record replaces any older
+  one for the same path when the cache is saved.  If there's no memory
+  for it, the update is dropped and the file is scanned again next time.
+
+  @param cache the cache to update.
+  @param path the path of the file.
+  @param rec the record to store.
+*/
+void updateCache( Cache *cache, const char *path, const CacheRecord *rec );
+
+/**
+  Writes the cache to the given file, replacing it atomically.  Old
+  records that weren't looked up in this run are dropped if their path
+  no longer exists.
+
+  @param cache the cache to save.
+  @param path name of the cache file.
+  @return true if the cache was written.
+*/
+bool saveCache( Cache *cache, const char *path );
+
+/**
+  Frees all the memory and the mapping used by the cache.
+
+  @param cache the cache to free.
+*/
+void freeCache( Cache *cache );
+
+/**
+  Gets the comment statistics for one regular file.  If the cache has a
+  record with the same size and modification time, the file isn't even
+  opened.  Otherwise the file is mapped, and if the record's size
+  matches it is hashed and only goes through the scanner when the hash
+  doesn't match the cached one either.
+  The new record is stored in the cache.  Different threads can use this
+  at the same time as long as they use different caches.
+
+  @param cache the cache to use, or NULL to always scan the file.
+  @param path the name of the file.
+  @param st the status of the file, from stat or lstat.
+  @param rec filled in with the statistics for the file.
+  @param hit filled in with true if the statistics came from the cache.
+  @return true if the file could be read.
+*/
+bool cachedFileStats( Cache *cache, const char *path, const struct stat *st,
+                      CacheRecord *rec, bool *hit );
+
+/**
+  Computes a fast 64-bit hash of a buffer, a word at a time.
+
+  @param buf the bytes to hash.
+  @param len number of bytes in the buffer.
+  @return the hash value.
+*/
+uint64_t hashContents( const char *buf, size_t len );
+
+#endif
@@ -0,0 +1,510 @@
+/**
+  @file commentbench.c
+  @author Jesse Liddle (jaliddl2)
+
+  Benchmark for the comments program.  It generates synthetic corpora
+  with a chosen size, comment density, comment length distribution and
+  frequency of stray '/' and '*' characters, then runs every way of
+  scanning them: a simple byte-at-a-time reference scanner built into
+  this program, comments reading the corpus from standard input and
+  comments mapping the corpus as a file argument.  It reports GB/s for
+  each one and checks that they all agree on the counts.
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// Size of the blocks the generator writes.
+#define GEN_BLOCK ( 1 << 16 )
+
+// Bytes in a gigabyte, for the throughput report.
+#define GIGABYTE ( 1024.0 * 1024.0 * 1024.0 )
+
+// Longest line of output we expect from comments.
+#define LINE_LEN 256
+
+// Number of times each variant runs; the fastest run is reported.
+#define RUNS 3
+
+/** Parameters for one generated corpus. */
+typedef struct {
+  // Size of the corpus in bytes.
+  long long size;
+  // Fraction of the bytes that should be inside comments.
+  double density;
+  // Mean length of a comment, including its delimiters.
+  int meanLen;
+  // Comment length distribution: 'f'ixed, 'u'niform or 'e'xponential.
+  char dist;
+  // Fraction of ordinary characters replaced with a stray '/' or '*'.
+  double stray;
+  // Seed for the random number generator.
+  unsigned long long seed;
+} Params;
+
+/** Counts reported by one scan of a corpus. */
+typedef struct {
+  long long chars;
+  long long comments;
+  // Percentage of the characters inside comments.
+  double percent;
+  bool unterminated;
+} Counts;
+
+// State of the random number generator.
+static unsigned long long rngState;
+
+/**
+  Returns the next value from a xorshift64* generator.
+
+  @return a random 64-bit value.
+*/
+static unsigned long long nextRandom()
+{
+  rngState ^= rngState >> 12;
+  rngState ^= rngState << 25;
+  rngState ^= rngState >> 27;
+  return rngState * 0x2545f4914f6cdd1dull;
+}
+
+/**
+  Returns a random double in [0, 1).
+
+  @return the random value.
+*/
+static double randomUnit()
+{
+  return ( nextRandom() >> 11 ) * ( 1.0 / 9007199254740992.0 );
+}
+
+/**
+  Returns a random length from the exponential distribution with the given
+  mean, at least one.
+
+  @param mean the mean of the distribution.
+  @return the random length.
+*/
+static long long randomExp( double mean )
+{
+  double u = randomUnit();
+  long long len = (long long) ( -mean * log1p( -u ) );
+  return len < 1 ? 1 : len;
+}
+
+/**
+  Returns the length of the next comment, including "/" "*" and "*" "/".
+
+  @param p the corpus parameters.
+  @return the comment length.
+*/
+static long long commentLength( const Params *p )
+{
+  long long len;
+  if ( p->dist == 'u' )
+    len = 1 + nextRandom() % ( 2 * p->meanLen );
+  else if ( p->dist == 'e' )
+    len = randomExp( p->meanLen );
+  else
+    len = p->meanLen;
+  return len < 4 ? 4 : len;
+}
+
+/** Output buffer for the generator. */
+typedef struct {
+  FILE *fp;
+  char buf[ GEN_BLOCK ];
+  int len;
+  long long written;
+} Writer;
+
+/**
+  Adds one character to the output.
+
+  @param w the writer.
+  @param ch the character to add.
+*/
+static void put( Writer *w, char ch )
+{
+  w->buf[ w->len++ ] = ch;
+  w->written++;
+  if ( w->len == GEN_BLOCK ) {
+    fwrite( w->buf, 1, w->len, w->fp );
+    w->len = 0;
+  }
+}
+
+/**
+  Adds ordinary text to the output.  A stray '/' is never followed by a
+  '*' here, and a stray '*' inside a comment is never followed by a '/',
+  so the stray characters never change where comments start or end.
+
+  @param w the writer.
+  @param n the number of characters to add.
+  @param p the corpus parameters.
+  @param inComment true if the text is inside a comment.
+*/
+static void putText( Writer *w, long long n, const Params *p, bool inComment )
+{
+  static const char letters[] = "abcdefghijklmnopqrstuvwxyz ;{}()=\n";
+  char last = 0;
+  for ( long long i = 0; i < n; i++ ) {
+    unsigned long long r = nextRandom();
+    char ch = letters[ r % ( sizeof( letters ) - 1 ) ];
+    if ( ( r >> 32 ) * ( 1.0 / 4294967296.0 ) < p->stray ) {
+      ch = ( r >> 20 ) & 1 ? '/' : '*';
+      if ( !inComment && last == '/' && ch == '*' )
+        ch = '/';
+      if ( inComment && last == '*' && ch == '/' )
+        ch = '*';
+    }
+    put( w, ch );
+    last = ch;
+  }
+}
+
+/**
+  Writes a corpus with the given parameters to the given file.
+
+  @param path the file to write.
+  @param p the corpus parameters.
+  @return true if the file was written.
+*/
+static bool generate( const char *path, const Params *p )
+{
+  static Writer w;
+  w.fp = fopen( path, "wb" );
+  if ( !w.fp )
+    return false;
+  w.len = 0;
+  w.written = 0;
+  rngState = p->seed ? p->seed : 1;
+
+  // Mean gap between comments that gives the requested density.
+  double gap = p->density > 0 ? p->meanLen * ( 1 - p->density ) / p->density : 0;
+
+  while ( w.written < p->size ) {
+    long long left = p->size - w.written;
+    if ( p->density <= 0 ) {
+      putText( &w, left, p, false );
+      break;
+    }
+
+    long long text = gap > 0 ? randomExp( gap ) : 0;
+    putText( &w, text < left ? text : left, p, false );
+    left = p->size - w.written;
+
+    long long len = commentLength( p );
+    if ( len > left ) {
+      putText( &w, left, p, false );
+      break;
+    }
+    put( &w, '/' );
+    put( &w, '*' );
+    putText( &w, len - 4, p, true );
+    put( &w, '*' );
+    put( &w, '/' );
+  }
+
+  fwrite( w.buf, 1, w.len, w.fp );
+  return fclose( w.fp ) == 0;
+}
+
+/**
+  Returns the current value of the monotonic clock in seconds.
+
+  @return the time in seconds.
+*/
+static double now()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+  Counts the corpus one byte at a time with a plain state machine.  This
+  is the slowest scanner and the one the others are checked against.
+
+  @param buf the corpus.
+  @param len the size of the corpus.
+  @param c filled in with the counts.
+*/
+static void referenceScan( const unsigned char *buf, long long len, Counts *c )
+{
+  // 0 = text, 1 = text after '/', 2 = comment, 3 = comment after '*'
+  int state = 0;
+  long long start = 0;
+  long long commentChars = 0;
+  memset( c, 0, sizeof( *c ) );
+
+  for ( long long i = 0; i < len; i++ ) {
+    unsigned char ch = buf[ i ];
+    if ( state == 0 ) {
+      if ( ch == '/' )
+        state = 1;
+    } else if ( state == 1 ) {
+      if ( ch == '*' ) {
+        state = 2;
+        start = i - 1;
+        c->comments++;
+      } else if ( ch != '/' ) {
+        state = 0;
+      }
+    } else if ( state == 2 ) {
+      if ( ch == '*' )
+        state = 3;
+    } else {
+      if ( ch == '/' ) {
+        state = 0;
+        commentChars += i - start + 1;
+      } else if ( ch != '*' ) {
+        state = 2;
+      }
+    }
+  }
+
+  c->chars = len;
+  c->percent = len > 0 ? (double) commentChars / len * 100 : 0;
+  c->unterminated = state >= 2;
+}
+
+/**
+  Runs the comments program on the corpus and parses its report.
+
+  @param prog path of the comments program.
+  @param path the corpus file.
+  @param useStdin true to feed the corpus on standard input, false to
+  pass it as a file argument.
+  @param c filled in with the counts from the report.
+  @return true if the program ran and printed a report we understood.
+*/
+static bool runComments( const char *prog, const char *path, bool useStdin,
+                         Counts *c )
+{
+  int out[ 2 ];
+  if ( pipe( out ) != 0 )
+    return false;
+
+  pid_t pid = fork();
+  if ( pid == 0 ) {
+    if ( useStdin ) {
+      int fd = open( path, O_RDONLY );
+      dup2( fd, STDIN_FILENO );
+      close( fd );
+    }
+    dup2( out[ 1 ], STDOUT_FILENO );
+    close( out[ 0 ] );
+    close( out[ 1 ] );
+    if ( useStdin )
+      execl( prog, prog, (char *) NULL );
+    else
+      execl( prog, prog, path, (char *) NULL );
+    _exit( 127 );
+  }
+  close( out[ 1 ] );
+
+  FILE *fp = fdopen( out[ 0 ], "r" );
+  char line[ LINE_LEN ];
+  memset( c, 0, sizeof( *c ) );
+  bool ok = true;
+  while ( fgets( line, sizeof( line ), fp ) ) {
+    if ( strncmp( line, "Unterminated comment", 20 ) == 0 )
+      c->unterminated = true;
+    else if ( sscanf( line, "Input characters: %lld", &c->chars ) == 1 )
+      ;
+    else
+      sscanf( line, "Comments: %lld (%lf%%)", &c->comments, &c->percent );
+  }
+  fclose( fp );
+
+  int status;
+  waitpid( pid, &status, 0 );
+  if ( !WIFEXITED( status ) || WEXITSTATUS( status ) == 127 )
+    ok = false;
+  return ok;
+}
+
+/**
+  Checks whether a program report agrees with the reference counts.  The
+  program only prints the comment percentage, so that is compared to the
+  two decimal places it prints.
+
+  @param ref the reference counts.
+  @param c the counts from the program.
+  @return true if they agree.
+*/
+static bool agrees( const Counts *ref, const Counts *c )
+{
+  if ( ref->unterminated || c->unterminated )
+    return ref->unterminated == c->unterminated;
+  return ref->chars == c->chars && ref->comments == c->comments
+    && fabs( ref->percent - c->percent ) < 0.0051;
+}
+
+/**
+  Parses a size with an optional K, M or G suffix.
+
+  @param s the string to parse.
+  @return the size in bytes, or -1 if it isn't valid.
+*/
+static long long parseSize( const char *s )
+{
+  char *end;
+  long long n = strtoll( s, &end, 10 );
+  if ( *end == 'K' || *end == 'k' )
+    n <<= 10, end++;
+  else if ( *end == 'M' || *end == 'm' )
+    n <<= 20, end++;
+  else if ( *end == 'G' || *end == 'g' )
+    n <<= 30, end++;
+  return *end == '\0' && n > 0 ? n : -1;
+}
+
+/**
+  Prints one line of the report.
+
+  @param p the corpus parameters.
+  @param name the name of the scanner variant.
+  @param secs the time the scan took.
+  @param c the counts it reported.
+  @param ok true if it agreed with the reference.
+*/
+static void report( const Params *p, const char *name, double secs,
+                    const Counts *c, bool ok )
+{
+  printf( "%12lld %5.2f %6d %c %5.3f  %-9s %8.3f GB/s  chars %lld comments %lld"
+          " (%.2f%%)%s\n", p->size, p->density, p->meanLen, p->dist, p->stray, name,
+          secs > 0 ? p->size / GIGABYTE / secs : 0.0, c->chars, c->comments, c->percent,
+          c->unterminated ? " unterminated" : ok ? "" : "  MISMATCH" );
+}
+
+/**
+  Generates one corpus and runs every scanner variant on it.
+
+  @param p the corpus parameters.
+  @param prog path of the comments program.
+  @param path temporary file for the corpus.
+  @return true if every variant agreed with the reference.
+*/
+static bool benchmark( const Params *p, const char *prog, const char *path )
+{
+  if ( !generate( path, p ) ) {
+    fprintf( stderr, "Can't write corpus: %s\n", path );
+    return false;
+  }
+
+  int fd = open( path, O_RDONLY );
+  void *map = mmap( NULL, p->size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  close( fd );
+  if ( map == MAP_FAILED ) {
+    fprintf( stderr, "Can't map corpus: %s\n", path );
+    return false;
+  }
+
+  Counts ref;
+  double best = 0;
+  for ( int r = 0; r < RUNS; r++ ) {
+    double t = now();
+    referenceScan( (const unsigned char *) map, p->size, &ref );
+    t = now() - t;
+    if ( r == 0 || t < best )
+      best = t;
+  }
+  munmap( map, p->size );
+  report( p, "reference", best, &ref, true );
+
+  bool allOk = true;
+  for ( int v = 0; v < 2; v++ ) {
+    Counts c;
+    bool ok = true;
+    for ( int r = 0; r < RUNS; r++ ) {
+      double t = now();
+      ok = runComments( prog, path, v == 0, &c ) && ok;
+      t = now() - t;
+      if ( r == 0 || t < best )
+        best = t;
+    }
+    ok = ok && agrees( &ref, &c );
+    report( p, v == 0 ? "stdin" : "mmap", best, &c, ok );
+    allOk = allOk && ok;
+  }
+
+  return allOk;
+}
+
+/**
+  Starting point for the benchmark.  With no options it runs a standard
+  sweep of sizes and corpus shapes; the options pick a single corpus.
+*/
+int main( int argc, char *argv[] )
+{
+  Params p = { 0, 0.3, 40, 'e', 0.01, 12345 };
+  const char *prog = "./comments";
+  const char *path = "bench_corpus.txt";
+  bool single = false;
+  int opt;
+
+  while ( ( opt = getopt( argc, argv, "s:d:l:D:x:r:p:o:" ) ) != -1 ) {
+    switch ( opt ) {
+    case 's': p.size = parseSize( optarg ); single = true; break;
+    case 'd': p.density = atof( optarg ); break;
+    case 'l': p.meanLen = atoi( optarg ); break;
+    case 'D': p.dist = optarg[ 0 ]; break;
+    case 'x': p.stray = atof( optarg ); break;
+    case 'r': p.seed = strtoull( optarg, NULL, 10 ); break;
+    case 'p': prog = optarg; break;
+    case 'o': path = optarg; break;
+    default: p.size = -1; break;
+    }
+  }
+
+  if ( p.size < 0 || p.density < 0 || p.density >= 1 || p.meanLen < 4
+       || ( p.dist != 'f' && p.dist != 'u' && p.dist != 'e' ) || optind != argc ) {
+    fprintf( stderr, "usage: commentbench [-s size[K|M|G]] [-d density] "
+             "[-l mean_length] [-D f|u|e] [-x stray_fraction] [-r seed] "
+             "[-p comments_program] [-o corpus_file]\n" );
+    return EXIT_FAILURE;
+  }
+
+  printf( "%12s %5s %6s %c %5s  %-9s %13s\n", "bytes", "dens", "len", 'D',
+          "stray", "variant", "throughput" );
+
+  bool ok = true;
+  if ( single ) {
+    ok = benchmark( &p, prog, path );
+  } else {
+    // The standard sweep: sizes from KB to hundreds of MB, and for the
+    // largest size a few corpus shapes, including pathological ones.
+    static const long long sizes[] = { 64LL << 10, 1LL << 20, 64LL << 20, 256LL << 20 };
+    for ( int i = 0; i < sizeof( sizes ) / sizeof( sizes[ 0 ] ); i++ ) {
+      p.size = sizes[ i ];
+      ok = benchmark( &p, prog, path ) && ok;
+    }
+
+    static const Params shapes[] = {
+      { 64LL << 20, 0.0, 40, 'f', 0.0, 1 },
+      { 64LL << 20, 0.9, 4000, 'u', 0.0, 2 },
+      { 64LL << 20, 0.5, 6, 'f', 0.0, 3 },
+      { 64LL << 20, 0.3, 40, 'e', 0.5, 4 },
+    };
+    for ( int i = 0; i < sizeof( shapes ) / sizeof( shapes[ 0 ] ); i++ )
+      ok = benchmark( &shapes[ i ], prog, path ) && ok;
+  }
+
+  remove( path );
+  if ( !ok ) {
+    printf( "Scanner variants DISAGREE\n" );
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
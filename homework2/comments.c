@@ -4,107 +4,457 @@
 
   This program reads input from a file and counts how many
   characters there are in the file and how many old C-style comments
-  there are in this file.
+  there are in this file.  The scanning itself is done by the scanner
+  library; this file just handles the command line and the output.
 */
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "comments.h"
+#include "scanner.h"
+#include "cache.h"
+#include "spans.h"
+#include "watch.h"
 
 #define EXIT_EMPTY 100
 #define EXIT_UNTERM 101
 #define EXIT_SUCCESS 0
 #define PERCENT 100
 
-// Total count of characters.
-int totalChars = 0;
+// Size of the blocks read from standard input.
+#define BLOCK_SIZE ( 1 << 16 )
 
-// Total count of characters that are part of a comment.
-int commentChars = 0;
+// Minimum number of seconds between two progress lines.
+#define PROGRESS_INTERVAL 1.0
 
-// Total number of comments in the input.
-int commentCount = 0;
+// Bytes in a megabyte, for the throughput report.
+#define MEGABYTE ( 1024.0 * 1024.0 )
 
-//True if the comment ended and false if it did not.
-bool commentEnded = true;
+/** Totals over all the files named on the command line. */
+typedef struct {
+  long long chars;
+  long long commentChars;
+  long long comments;
+  // Number of files whose statistics came from the cache or a new scan.
+  long long cacheHits;
+  long long scanned;
+  // True if some file couldn't be read.
+  bool readFailed;
+  // True if some file ended inside a comment.
+  bool unterminated;
+} Totals;
 
+/** Where the comment callback sends spans when extracting or stripping. */
+typedef struct {
+  // The input being scanned.
+  const char *input;
+  // Output mode: 'x' to extract comments, 's' to strip them.
+  char mode;
+  // End of the last comment seen.
+  long long lastEnd;
+  SpanWriter out;
+} SpanState;
 
 /**
-  This is the main function of the program and it starts when
-  the program starts running.  It opens the input file and starts
-  reading for comments then calls processComment when it sees a
-  comment
- */
-int main ()
+  Returns the current value of the monotonic clock in seconds.
+
+  @return the time in seconds.
+*/
+static double now()
 {
-  char nextChar = getchar();
-  
-  if ( nextChar == EOF ) {
-    printf("Empty input\n");
-    return EXIT_EMPTY;
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+  Prints a progress line to standard error with the bytes processed so far,
+  the comment ratio and the throughput since the scan started.
+
+  @param chars The number of characters processed.
+  @param comments The number of comments seen.
+  @param inComments The number of characters inside comments.
+  @param start The time the scan started.
+  @param current The current time.
+*/
+static void reportProgress( long long chars, long long comments,
+                            long long inComments, double start, double current )
+{
+  double percent = 0.0;
+  if ( chars > 0 )
+    percent = ((double) inComments) / ((double) chars) * PERCENT;
+
+  double elapsed = current - start;
+  double rate = elapsed > 0 ? chars / MEGABYTE / elapsed : 0.0;
+
+  fprintf( stderr, "Processed: %lld bytes, comments %lld (%.2f%%), %.1f MB/s\n",
+           chars, comments, percent, rate );
+}
+
+/**
+  Adds the statistics for the given file to the totals.  A directory is
+  walked recursively, and symbolic links are skipped so a link cycle
+  can't make the walk go on forever.
+
+  @param path The file or directory to count.
+  @param cache The cache to use, or NULL to always scan.
+  @param totals The totals to add to.
+*/
+static void countPath( const char *path, Cache *cache, Totals *totals )
+{
+  struct stat st;
+  if ( lstat( path, &st ) != 0 ) {
+    fprintf( stderr, "Can't open file: %s\n", path );
+    totals->readFailed = true;
+    return;
+  }
+
+  if ( S_ISDIR( st.st_mode ) ) {
+    DIR *dir = opendir( path );
+    if ( dir == NULL ) {
+      fprintf( stderr, "Can't open directory: %s\n", path );
+      totals->readFailed = true;
+      return;
+    }
+
+    struct dirent *ent;
+    while ( ( ent = readdir( dir ) ) != NULL ) {
+      if ( strcmp( ent->d_name, "." ) == 0 || strcmp( ent->d_name, ".." ) == 0 )
+        continue;
+      size_t len = strlen( path ) + strlen( ent->d_name ) + 2;
+      char *child = (char *) malloc( len );
+      snprintf( child, len, "%s/%s", path, ent->d_name );
+      countPath( child, cache, totals );
+      free( child );
+    }
+    closedir( dir );
+    return;
+  }
+
+  if ( !S_ISREG( st.st_mode ) )
+    return;
+
+  CacheRecord rec;
+  bool hit;
+  if ( !cachedFileStats( cache, path, &st, &rec, &hit ) ) {
+    fprintf( stderr, "Can't open file: %s\n", path );
+    totals->readFailed = true;
+    return;
+  }
+
+  if ( hit )
+    totals->cacheHits++;
+  else
+    totals->scanned++;
+
+  if ( rec.unterminated ) {
+    printf( "Unterminated comment: %s\n", path );
+    totals->unterminated = true;
+  }
+
+  totals->chars += rec.totalChars;
+  totals->commentChars += rec.commentChars;
+  totals->comments += rec.commentCount;
+}
+
+/**
+  Receives each complete comment while extracting or stripping.  In
+  extract mode the comment itself becomes a span, followed by a newline;
+  in strip mode it's the text between the previous comment and this one.
+
+  @param data the SpanState for the scan.
+  @param start offset of the '/' that starts the comment.
+  @param end offset just past the '/' that ends the comment.
+*/
+static void spanSink( void *data, long long start, long long end )
+{
+  static const char newline = '\n';
+  SpanState *state = (SpanState *) data;
+  if ( state->mode == 'x' ) {
+    addSpan( &state->out, state->input + start, end - start );
+    addSpan( &state->out, &newline, 1 );
   } else {
-  
-    while ( nextChar != EOF ) {
-      totalChars++;
-      
-      if ( nextChar == '/' ) {
-        nextChar = getchar();
-        if ( nextChar == '*' ) {
-          processComment();
-        } else
-          totalChars++;
+    addSpan( &state->out, state->input + state->lastEnd, start - state->lastEnd );
+  }
+  state->lastEnd = end;
+}
+
+/**
+  Maps the whole of an open file into memory.  Input that can't be
+  mapped, like a pipe, is read into an allocated buffer instead.
+
+  @param fd the file to map.
+  @param len filled in with the length of the input.
+  @param mapped filled in with true if the input was mapped and must be
+  released with munmap, or false if it was read and must be freed, even
+  when it's empty.
+  @return the start of the input, or NULL if it couldn't be read.
+*/
+static const char *mapInput( int fd, size_t *len, bool *mapped )
+{
+  struct stat st;
+  *mapped = false;
+  // An empty file can't be mapped, so it is read like a pipe
+  if ( fstat( fd, &st ) == 0 && S_ISREG( st.st_mode ) && st.st_size > 0 ) {
+    *len = st.st_size;
+    void *map = mmap( NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0 );
+    if ( map != MAP_FAILED ) {
+      posix_madvise( map, *len, POSIX_MADV_SEQUENTIAL );
+      *mapped = true;
+      return map;
+    }
+  }
+
+  size_t cap = BLOCK_SIZE;
+  char *buf = (char *) malloc( cap );
+  if ( buf == NULL )
+    return NULL;
+  ssize_t n;
+  *len = 0;
+  while ( ( n = read( fd, buf + *len, cap - *len ) ) > 0 ) {
+    *len += n;
+    if ( *len == cap ) {
+      char *bigger = (char *) realloc( buf, cap * 2 );
+      if ( bigger == NULL ) {
+        n = -1;
+        break;
       }
-      
-      nextChar = getchar();
+      buf = bigger;
+      cap *= 2;
     }
   }
-  
-  if ( commentEnded == false ) {
-    printf("Unterminated comment\n");
+  if ( n < 0 ) {
+    free( buf );
+    return NULL;
+  }
+  return buf;
+}
+
+/**
+  Writes either the comments or everything except the comments from the
+  given input to standard output.  Messages go to standard error, since
+  standard output carries the text itself.
+
+  @param fd the input file.
+  @param name name of the input for messages.
+  @param state the output mode and span writer.
+  @return an exit status for the program.
+*/
+static int emitSpans( int fd, const char *name, SpanState *state )
+{
+  size_t len;
+  bool mapped;
+  const char *buf = mapInput( fd, &len, &mapped );
+  if ( buf == NULL ) {
+    fprintf( stderr, "Can't open file: %s\n", name );
+    return EXIT_FAILURE;
+  }
+
+  CommentScanner s;
+  state->input = buf;
+  state->lastEnd = 0;
+  bool complete = scanBuffer( &s, buf, len, spanSink, state );
+
+  // An unterminated comment runs to the end of the input, so stripping
+  // keeps only the text before it.
+  if ( state->mode == 's' )
+    addSpan( &state->out, buf + state->lastEnd,
+             ( complete ? (long long) len : s.commentStart ) - state->lastEnd );
+  bool ok = flushSpans( &state->out );
+
+  if ( mapped )
+    munmap( (void *) buf, len );
+  else
+    free( (void *) buf );
+
+  if ( !ok ) {
+    fprintf( stderr, "Can't write output\n" );
+    return EXIT_FAILURE;
+  }
+  if ( len == 0 ) {
+    fprintf( stderr, "Empty input\n" );
+    return EXIT_EMPTY;
+  }
+  if ( !complete ) {
+    fprintf( stderr, "Unterminated comment: %s\n", name );
     return EXIT_UNTERM;
-  } else {
-    totalChars += commentChars;
+  }
+  return EXIT_SUCCESS;
+}
 
-    //Computes the percent of characters that are inside a comment in the file.
-    double percent = ((double) commentChars) / ((double) totalChars) * PERCENT;
+/**
+  Extracts or strips the comments of every file named on the command
+  line, or of standard input if there aren't any.
 
-    printf("Input characters: %d\n", totalChars);
-    printf("Comments: %d (%.2f)\n", commentCount, percent);
+  @param mode 'x' to extract comments, 's' to strip them.
+  @param first index of the first file name in argv.
+  @param argc number of command-line arguments.
+  @param argv the command-line arguments.
+  @return an exit status for the program.
+*/
+static int emitAll( char mode, int first, int argc, char *argv[] )
+{
+  static SpanState state;
+  state.mode = mode;
+  initSpanWriter( &state.out, STDOUT_FILENO );
+  if ( first == argc )
+    return emitSpans( STDIN_FILENO, "standard input", &state );
 
-    return EXIT_SUCCESS;
+  int status = EXIT_SUCCESS;
+  for ( int i = first; i < argc; i++ ) {
+    int fd = open( argv[ i ], O_RDONLY );
+    int result = EXIT_FAILURE;
+    if ( fd < 0 ) {
+      fprintf( stderr, "Can't open file: %s\n", argv[ i ] );
+    } else {
+      result = emitSpans( fd, argv[ i ], &state );
+      close( fd );
+    }
+    if ( result != EXIT_SUCCESS )
+      status = result;
   }
+  return status;
 }
 
 /**
-  This function will be called after the program sees the '/' '*'
-  character sequence representing the start of a comment. Its job
-  will be to keep reading input (and counting characters) until it
-  sees the end of a comment sequence
+  This is the main function of the program and it starts when
+  the program starts running.  Without file arguments it feeds standard
+  input to the scanner a block at a time.  With file or directory
+  arguments it reports the totals for all the files, using the cache
+  file given with -c to skip files that haven't changed.  With the -p
+  option it also reports its progress on standard error.  The -x and -s
+  options write the comments themselves, or the input with the comments
+  removed, to standard output instead of counting.  The -w option keeps
+  running, watching the named trees and serving the totals on a socket.
  */
-void processComment ()
+int main( int argc, char *argv[] )
 {
-  commentCount ++; //Increases the comment count.
-  
-  char nextChar = getchar(); //This is looking at the next char in the sequence
-  int totalComment = 2;
-  commentEnded = true;
-  
-  while ( nextChar != EOF ) {
-    totalComment++; //Increases comment character count
-    
-    if ( nextChar == '*' ) {
-      nextChar = getchar();
-      if ( nextChar == '/' ) {
-        commentChars = commentChars + totalComment;
-        return;
+  bool progress = false;
+  const char *cachePath = NULL;
+  const char *socketPath = NULL;
+  char mode = 0;
+  int opt;
+  while ( ( opt = getopt( argc, argv, "pc:xsw:" ) ) != -1 ) {
+    if ( opt == 'p' ) {
+      progress = true;
+    } else if ( opt == 'c' ) {
+      cachePath = optarg;
+    } else if ( ( opt == 'x' || opt == 's' ) && !mode ) {
+      mode = opt;
+    } else if ( opt == 'w' ) {
+      socketPath = optarg;
+    } else {
+      fprintf( stderr, "usage: comments [-p] [-c cache_file] [-x | -s | -w socket] "
+               "[file ...]\n" );
+      return EXIT_FAILURE;
+    }
+  }
+
+  if ( mode )
+    return emitAll( mode, optind, argc, argv );
+
+  if ( socketPath ) {
+    if ( optind == argc ) {
+      fprintf( stderr, "usage: comments -w socket [-c cache_file] directory ...\n" );
+      return EXIT_FAILURE;
+    }
+
+    Cache *cache = cachePath ? loadCache( cachePath ) : NULL;
+    int status = watchTree( argc - optind, argv + optind, socketPath, cache );
+    if ( cache ) {
+      saveCache( cache, cachePath );
+      freeCache( cache );
+    }
+    return status;
+  }
+
+  double start = progress ? now() : 0.0;
+  long long totalChars;
+  long long commentChars;
+  long long commentCount;
+  bool commentEnded;
+
+  if ( optind < argc ) {
+    Cache *cache = cachePath ? loadCache( cachePath ) : NULL;
+    Totals totals = { 0 };
+
+    for ( int i = optind; i < argc; i++ )
+      countPath( argv[ i ], cache, &totals );
+
+    if ( cache ) {
+      if ( !saveCache( cache, cachePath ) )
+        fprintf( stderr, "Can't write cache file: %s\n", cachePath );
+      freeCache( cache );
+    }
+
+    if ( progress )
+      fprintf( stderr, "Files: %lld from cache, %lld scanned\n",
+               totals.cacheHits, totals.scanned );
+
+    if ( totals.readFailed )
+      return EXIT_FAILURE;
+    if ( totals.unterminated )
+      return EXIT_UNTERM;
+
+    totalChars = totals.chars;
+    commentChars = totals.commentChars;
+    commentCount = totals.comments;
+    commentEnded = true;
+  } else {
+    static char block[ BLOCK_SIZE ];
+    CommentScanner s;
+    double lastReport = start;
+    size_t len;
+
+    initScanner( &s, NULL, NULL );
+    while ( ( len = fread( block, 1, BLOCK_SIZE, stdin ) ) > 0 ) {
+      scanChunk( &s, block, len );
+
+      // The clock is only read once per block, so this costs nothing
+      // noticeable next to the scan itself.
+      if ( progress ) {
+        double current = now();
+        if ( current - lastReport >= PROGRESS_INTERVAL ) {
+          reportProgress( s.totalChars, s.commentCount, s.commentChars,
+                          start, current );
+          lastReport = current;
+        }
       }
     }
 
-    nextChar = getchar();
-  } //End of while loop
-  
-  if ( nextChar == EOF ) {
-    commentEnded = false;
-    return;
+    totalChars = s.totalChars;
+    commentChars = s.commentChars;
+    commentCount = s.commentCount;
+    commentEnded = scanComplete( &s );
   }
-} //End of processComment function
\ No newline at end of file
+
+  if ( totalChars == 0 ) {
+    printf("Empty input\n");
+    return EXIT_EMPTY;
+  }
+
+  if ( commentEnded == false ) {
+    printf("Unterminated comment\n");
+    return EXIT_UNTERM;
+  } else {
+    //Computes the percent of characters that are inside a comment in the file.
+    double percent = ((double) commentChars) / ((double) totalChars) * PERCENT;
+
+    if ( progress )
+      reportProgress( totalChars, commentCount, commentChars, start, now() );
+
+    printf("Input characters: %lld\n", totalChars);
+    printf("Comments: %lld (%.2f%%)\n", commentCount, percent);
+
+    return EXIT_SUCCESS;
+  }
+}
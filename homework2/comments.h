@@ -1,6 +1,4 @@
 /*
   Header file for comments.c
 */
-int main ();
-
-void processComment ();
\ No newline at end of file
+int main( int argc, char *argv[] );
@@ -0,0 +1,89 @@
+/**
+  @file scanner.c
+  @author Jesse Liddle (jaliddl2)
+
+  Implementation of the comment scanner.
+*/
+
+#include "scanner.h"
+#include <string.h>
+
+void initScanner( CommentScanner *s, CommentCallback callback, void *data )
+{
+  s->totalChars = 0;
+  s->commentChars = 0;
+  s->commentCount = 0;
+  s->inComment = false;
+  s->pendingSlash = false;
+  s->pendingStar = false;
+  s->commentStart = 0;
+  s->callback = callback;
+  s->data = data;
+}
+
+/**
+  Outside a comment this jumps from one '/' to the next with memchr, and
+  inside a comment from one '*' to the next, so ordinary text is never
+  looked at a byte at a time.
+*/
+void scanChunk( CommentScanner *s, const char *buf, size_t len )
+{
+  const char *p = buf;
+  const char *end = buf + len;
+
+  while ( p < end ) {
+    if ( !s->inComment ) {
+      if ( s->pendingSlash ) {
+        s->pendingSlash = false;
+        if ( *p == '*' ) {
+          // The comment started with the '/' right before this character.
+          s->commentCount++;
+          s->commentStart = s->totalChars + ( p - buf ) - 1;
+          s->inComment = true;
+          p++;
+          continue;
+        }
+      }
+
+      const char *slash = memchr( p, '/', end - p );
+      if ( slash == NULL )
+        break;
+      s->pendingSlash = true;
+      p = slash + 1;
+    } else {
+      if ( s->pendingStar ) {
+        s->pendingStar = false;
+        if ( *p == '/' ) {
+          long long offset = s->totalChars + ( p - buf );
+          s->commentChars += offset - s->commentStart + 1;
+          s->inComment = false;
+          if ( s->callback )
+            s->callback( s->data, s->commentStart, offset + 1 );
+          p++;
+          continue;
+        }
+      }
+
+      const char *star = memchr( p, '*', end - p );
+      if ( star == NULL )
+        break;
+      s->pendingStar = true;
+      p = star + 1;
+    }
+  }
+
+  s->totalChars += len;
+}
+
+bool scanBuffer( CommentScanner *s, const char *buf, size_t len,
+                 CommentCallback callback, void *data )
+{
+  initScanner( s, callback, data );
+  scanChunk( s, buf, len );
+  return scanComplete( s );
+}
+
+bool scanComplete( const CommentScanner *s )
+{
+  return !s->inComment;
+}
@@ -0,0 +1,94 @@
+/**
+  @file scanner.h
+  @author Jesse Liddle (jaliddl2)
+
+  Reentrant scanner for old C-style comments.  All the state of a scan
+  lives in a CommentScanner object owned by the caller, so any number of
+  scans can run at once, in any number of threads, as long as each
+  scanner is only used by one thread at a time.  Input can be given as
+  one buffer or fed in chunks of any size.
+*/
+
+#ifndef _SCANNER_H_
+#define _SCANNER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+  Function called for every complete comment.  The offsets count from the
+  first byte ever fed to the scanner, so they stay meaningful across chunks.
+
+  @param data the pointer given to initScanner().
+  @param start offset of the '/' that starts the comment.
+  @param end offset just past the '/' that ends the comment.
+*/
+typedef void ( *CommentCallback )( void *data, long long start, long long end );
+
+/**
+  State of one scan.  The counts can be read at any time; the other fields
+  are private to scanner.c.
+*/
+typedef struct {
+  // Total count of characters.
+  long long totalChars;
+  // Total count of characters that are part of a complete comment.
+  long long commentChars;
+  // Total number of comments started.
+  long long commentCount;
+
+  // True while inside a comment.
+  bool inComment;
+  // True if the last character seen outside a comment was a '/'.
+  bool pendingSlash;
+  // True if the last character seen inside a comment was a '*'.
+  bool pendingStar;
+  // Offset of the '/' that started the current comment.
+  long long commentStart;
+
+  // Called for every complete comment, if not NULL.
+  CommentCallback callback;
+  void *data;
+} CommentScanner;
+
+/**
+  Prepares a scanner for a new input.
+
+  @param s the scanner to initialize.
+  @param callback function to call for each complete comment, or NULL.
+  @param data pointer passed along to the callback.
+*/
+void initScanner( CommentScanner *s, CommentCallback callback, void *data );
+
+/**
+  Scans the next chunk of the input.  A comment opener or closer split
+  between two chunks is handled correctly.
+
+  @param s the scanner.
+  @param buf the next bytes of the input.
+  @param len the number of bytes.
+*/
+void scanChunk( CommentScanner *s, const char *buf, size_t len );
+
+/**
+  Scans a complete input held in one buffer.
+
+  @param s the scanner, which is initialized by this function.
+  @param buf the input.
+  @param len the size of the input.
+  @param callback function to call for each complete comment, or NULL.
+  @param data pointer passed along to the callback.
+  @return true if the input didn't end inside a comment.
+*/
+bool scanBuffer( CommentScanner *s, const char *buf, size_t len,
+                 CommentCallback callback, void *data );
+
+/**
+  Reports whether everything scanned so far ends outside a comment.
+
+  @param s the scanner.
+  @return true if no comment is still open.
+*/
+bool scanComplete( const CommentScanner *s );
+
+#endif
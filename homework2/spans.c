@@ -0,0 +1,69 @@
+/**
+  @file spans.c
+  @author Jesse Liddle (jaliddl2)
+
+  Implementation of the span writer.
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include "spans.h"
+#include <errno.h>
+#include <unistd.h>
+
+void initSpanWriter( SpanWriter *w, int fd )
+{
+  w->fd = fd;
+  w->count = 0;
+  w->failed = false;
+}
+
+void addSpan( SpanWriter *w, const char *base, size_t len )
+{
+  if ( len == 0 )
+    return;
+
+  // Adjacent spans are merged, so stripping a few comments out of a large
+  // file still turns into a few large writes.
+  if ( w->count > 0 ) {
+    struct iovec *last = w->iov + w->count - 1;
+    if ( (const char *) last->iov_base + last->iov_len == base ) {
+      last->iov_len += len;
+      return;
+    }
+  }
+
+  if ( w->count == SPAN_BATCH )
+    flushSpans( w );
+  w->iov[ w->count ].iov_base = (void *) base;
+  w->iov[ w->count ].iov_len = len;
+  w->count++;
+}
+
+bool flushSpans( SpanWriter *w )
+{
+  struct iovec *iov = w->iov;
+  int count = w->count;
+  w->count = 0;
+
+  while ( count > 0 && !w->failed ) {
+    ssize_t n = writev( w->fd, iov, count );
+    if ( n < 0 ) {
+      if ( errno != EINTR )
+        w->failed = true;
+      continue;
+    }
+
+    // Skip past whatever was written; a short write leaves part of a span.
+    while ( count > 0 && (size_t) n >= iov->iov_len ) {
+      n -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if ( count > 0 ) {
+      iov->iov_base = (char *) iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+
+  return !w->failed;
+}
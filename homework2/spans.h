@@ -0,0 +1,59 @@
+/**
+  @file spans.h
+  @author Jesse Liddle (jaliddl2)
+
+  Gathers (pointer, length) spans of an input buffer and writes them with
+  writev, so selected parts of a mapped file can be copied to the output
+  without ever being copied byte by byte in user space.
+*/
+
+#ifndef _SPANS_H_
+#define _SPANS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+// Number of spans gathered before they are written with one writev call.
+#define SPAN_BATCH 1024
+
+/**
+  Spans waiting to be written to a file descriptor.
+*/
+typedef struct {
+  // Where the spans are written.
+  int fd;
+  // Spans gathered so far.
+  struct iovec iov[ SPAN_BATCH ];
+  int count;
+  // True if a write has failed; later spans are dropped.
+  bool failed;
+} SpanWriter;
+
+/**
+  Prepares a span writer for the given file descriptor.
+
+  @param w the writer to initialize.
+  @param fd the file descriptor to write to.
+*/
+void initSpanWriter( SpanWriter *w, int fd );
+
+/**
+  Adds a span to the output.  The memory must stay valid until the next
+  call to flushSpans(), which happens automatically once a batch is full.
+
+  @param w the writer.
+  @param base start of the span.
+  @param len number of bytes in the span.
+*/
+void addSpan( SpanWriter *w, const char *base, size_t len );
+
+/**
+  Writes all the gathered spans.
+
+  @param w the writer.
+  @return true if everything written so far went out successfully.
+*/
+bool flushSpans( SpanWriter *w );
+
+#endif
@@ -0,0 +1,632 @@
+/**
+  @file watch.c
+  @author Jesse Liddle (jaliddl2)
+
+  Implementation of watch mode.  The statistics for every file are kept
+  in a hash table along with running totals, so a change costs a rescan
+  of the one file that changed plus a constant amount of bookkeeping,
+  no matter how big the tree is.
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include "watch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define PERCENT 100
+
+// Initial number of buckets in the file table.
+#define INITIAL_BUCKETS 1024
+
+// Events that make us rescan a file or walk a new directory.
+#define CHANGE_EVENTS ( IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE )
+
+// Events that make us forget a file or directory.
+#define REMOVE_EVENTS ( IN_DELETE | IN_MOVED_FROM )
+
+// Size of the buffer used to read inotify events.
+#define EVENT_BUFFER 65536
+
+// Longest report sent over the socket.
+#define REPORT_LEN 512
+
+/** Statistics for one file in the table. */
+typedef struct EntryTag {
+  char *path;
+  CacheRecord rec;
+  struct EntryTag *next;
+} Entry;
+
+/** Everything watch mode keeps track of. */
+typedef struct {
+  // Hash table of files, chained.
+  Entry **buckets;
+  size_t bucketCount;
+  size_t fileCount;
+
+  // Running totals over every file in the table.
+  long long chars;
+  long long commentChars;
+  long long comments;
+  long long unterminated;
+
+  // Directory path for each inotify watch descriptor, or NULL, and
+  // whether the directory is only watched for the files named on the
+  // command line that are in it.
+  char **dirs;
+  bool *partial;
+  int dirCap;
+
+  // The paths named on the command line, with files written the way
+  // events in their directory name them, for rescanning everything.
+  char **roots;
+  int rootCount;
+
+  int inotifyFd;
+  Cache *cache;
+} Watch;
+
+// Set by the signal handler to make the main loop stop.
+static volatile sig_atomic_t stopRequested = 0;
+
+/**
+  Signal handler for SIGINT and SIGTERM.
+
+  @param sig the signal number.
+*/
+static void requestStop( int sig )
+{
+  stopRequested = 1;
+}
+
+/**
+  Hashes a path for the file table.
+
+  @param path the path to hash.
+  @return the hash value.
+*/
+static size_t hashPath( const char *path )
+{
+  size_t h = 14695981039346656037ull;
+  for ( const char *p = path; *p; p++ )
+    h = ( h ^ (unsigned char) *p ) * 1099511628211ull;
+  return h;
+}
+
+/**
+  Adds or subtracts a file's statistics from the running totals.
+
+  @param w the watch state.
+  @param rec the file's statistics.
+  @param sign 1 to add, -1 to subtract.
+*/
+static void adjustTotals( Watch *w, const CacheRecord *rec, int sign )
+{
+  w->chars += sign * rec->totalChars;
+  w->commentChars += sign * rec->commentChars;
+  w->comments += sign * rec->commentCount;
+  w->unterminated += sign * ( rec->unterminated ? 1 : 0 );
+}
+
+/**
+  Doubles the number of buckets in the file table.  If there's no memory
+  for more, the table keeps working with longer chains.
+
+  @param w the watch state.
+*/
+static void growTable( Watch *w )
+{
+  size_t count = w->bucketCount * 2;
+  Entry **buckets = (Entry **) calloc( count, sizeof( Entry * ) );
+  if ( buckets == NULL )
+    return;
+  for ( size_t i = 0; i < w->bucketCount; i++ ) {
+    Entry *e = w->buckets[ i ];
+    while ( e ) {
+      Entry *next = e->next;
+      size_t b = hashPath( e->path ) & ( count - 1 );
+      e->next = buckets[ b ];
+      buckets[ b ] = e;
+      e = next;
+    }
+  }
+  free( w->buckets );
+  w->buckets = buckets;
+  w->bucketCount = count;
+}
+
+/**
+  Stores new statistics for a file, replacing the old ones in the totals.
+
+  @param w the watch state.
+  @param path the file's path.
+  @param rec the new statistics.
+  @return false if there's no memory for a new entry.
+*/
+static bool setFile( Watch *w, const char *path, const CacheRecord *rec )
+{
+  Entry **slot = w->buckets + ( hashPath( path ) & ( w->bucketCount - 1 ) );
+  for ( Entry *e = *slot; e; e = e->next ) {
+    if ( strcmp( e->path, path ) == 0 ) {
+      adjustTotals( w, &e->rec, -1 );
+      e->rec = *rec;
+      adjustTotals( w, rec, 1 );
+      return true;
+    }
+  }
+
+  Entry *e = (Entry *) malloc( sizeof( Entry ) );
+  if ( e == NULL )
+    return false;
+  e->path = strdup( path );
+  if ( e->path == NULL ) {
+    free( e );
+    return false;
+  }
+  e->rec = *rec;
+  e->next = *slot;
+  *slot = e;
+  adjustTotals( w, rec, 1 );
+
+  if ( ++w->fileCount > w->bucketCount )
+    growTable( w );
+  return true;
+}
+
+/**
+  Forgets a file, or every file under a directory.
+
+  @param w the watch state.
+  @param path the file's path, or the directory's path.
+  @param isDir true to forget everything under the directory.
+*/
+static void removePath( Watch *w, const char *path, bool isDir )
+{
+  if ( !isDir ) {
+    Entry **link = w->buckets + ( hashPath( path ) & ( w->bucketCount - 1 ) );
+    for ( ; *link; link = &( *link )->next ) {
+      Entry *e = *link;
+      if ( strcmp( e->path, path ) == 0 ) {
+        adjustTotals( w, &e->rec, -1 );
+        *link = e->next;
+        free( e->path );
+        free( e );
+        w->fileCount--;
+        return;
+      }
+    }
+    return;
+  }
+
+  // Whole directories only go away now and then, so a pass over the
+  // table is fine here.
+  size_t len = strlen( path );
+  for ( size_t i = 0; i < w->bucketCount; i++ ) {
+    Entry **link = w->buckets + i;
+    while ( *link ) {
+      Entry *e = *link;
+      if ( strncmp( e->path, path, len ) == 0 && e->path[ len ] == '/' ) {
+        adjustTotals( w, &e->rec, -1 );
+        *link = e->next;
+        free( e->path );
+        free( e );
+        w->fileCount--;
+      } else {
+        link = &e->next;
+      }
+    }
+  }
+
+  for ( int wd = 0; wd < w->dirCap; wd++ ) {
+    char *dir = w->dirs[ wd ];
+    if ( dir && strncmp( dir, path, len ) == 0
+         && ( dir[ len ] == '/' || dir[ len ] == '\0' ) ) {
+      inotify_rm_watch( w->inotifyFd, wd );
+      free( dir );
+      w->dirs[ wd ] = NULL;
+    }
+  }
+}
+
+/**
+  Adds an inotify watch for a directory, if it doesn't have one already.
+
+  @param w the watch state.
+  @param path the directory.
+  @param fresh filled in with true if the directory wasn't watched yet.
+  @return the watch descriptor, or -1 if the directory can't be watched.
+*/
+static int watchDir( Watch *w, const char *path, bool *fresh )
+{
+  int wd = inotify_add_watch( w->inotifyFd, path,
+                              CHANGE_EVENTS | REMOVE_EVENTS | IN_ONLYDIR );
+  if ( wd < 0 )
+    return -1;
+
+  // A directory we have no room to remember isn't watched at all.
+  if ( wd >= w->dirCap ) {
+    int cap = w->dirCap ? w->dirCap : INITIAL_BUCKETS;
+    while ( wd >= cap )
+      cap *= 2;
+    char **dirs = (char **) realloc( w->dirs, cap * sizeof( char * ) );
+    if ( dirs )
+      w->dirs = dirs;
+    bool *partial = dirs ? (bool *) realloc( w->partial, cap * sizeof( bool ) ) : NULL;
+    if ( partial == NULL ) {
+      inotify_rm_watch( w->inotifyFd, wd );
+      return -1;
+    }
+    w->partial = partial;
+    memset( w->dirs + w->dirCap, 0, ( cap - w->dirCap ) * sizeof( char * ) );
+    w->dirCap = cap;
+  }
+
+  *fresh = w->dirs[ wd ] == NULL;
+  if ( *fresh ) {
+    w->dirs[ wd ] = strdup( path );
+    if ( w->dirs[ wd ] == NULL ) {
+      inotify_rm_watch( w->inotifyFd, wd );
+      return -1;
+    }
+    w->partial[ wd ] = false;
+  }
+  return wd;
+}
+
+/**
+  Watches the directory a file named on the command line is in.  Unless
+  the directory is already watched as part of a tree, only events about
+  files named on the command line are handled for it.
+
+  @param w the watch state.
+  @param path the file.
+  @return the file's path the way events in its directory name it,
+  which the caller frees, or NULL if the directory can't be watched.
+*/
+static char *watchParent( Watch *w, const char *path )
+{
+  const char *slash = strrchr( path, '/' );
+  const char *name = slash ? slash + 1 : path;
+  char *parent = slash == path ? strdup( "/" )
+    : slash ? strndup( path, slash - path ) : strdup( "." );
+  if ( parent == NULL )
+    return NULL;
+
+  bool fresh;
+  int wd = watchDir( w, parent, &fresh );
+  free( parent );
+  if ( wd < 0 )
+    return NULL;
+  if ( fresh )
+    w->partial[ wd ] = true;
+
+  size_t size = strlen( w->dirs[ wd ] ) + strlen( name ) + 2;
+  char *key = (char *) malloc( size );
+  if ( key == NULL )
+    return NULL;
+  snprintf( key, size, "%s/%s", w->dirs[ wd ], name );
+  return key;
+}
+
+/**
+  Tells if a path is one of the files named on the command line.
+
+  @param w the watch state.
+  @param path the path, the way an event names it.
+  @return true if it was named.
+*/
+static bool isRoot( const Watch *w, const char *path )
+{
+  for ( int i = 0; i < w->rootCount; i++ )
+    if ( strcmp( w->roots[ i ], path ) == 0 )
+      return true;
+  return false;
+}
+
+/**
+  Adds a file to the table, or watches a directory and adds everything
+  under it.  Symbolic links are skipped.
+
+  @param w the watch state.
+  @param path the file or directory.
+  @return false if the path couldn't be read.
+*/
+static bool addPath( Watch *w, const char *path )
+{
+  struct stat st;
+  if ( lstat( path, &st ) != 0 )
+    return false;
+
+  if ( S_ISREG( st.st_mode ) ) {
+    CacheRecord rec;
+    bool hit;
+    return cachedFileStats( w->cache, path, &st, &rec, &hit )
+      && setFile( w, path, &rec );
+  }
+
+  if ( !S_ISDIR( st.st_mode ) )
+    return true;
+
+  bool fresh;
+  int wd = watchDir( w, path, &fresh );
+  if ( wd < 0 )
+    return false;
+  w->partial[ wd ] = false;
+
+  DIR *dir = opendir( path );
+  if ( dir == NULL )
+    return false;
+
+  bool ok = true;
+  struct dirent *ent;
+  while ( ( ent = readdir( dir ) ) != NULL ) {
+    if ( strcmp( ent->d_name, "." ) == 0 || strcmp( ent->d_name, ".." ) == 0 )
+      continue;
+    size_t len = strlen( path ) + strlen( ent->d_name ) + 2;
+    char *child = (char *) malloc( len );
+    if ( child == NULL ) {
+      ok = false;
+      continue;
+    }
+    snprintf( child, len, "%s/%s", path, ent->d_name );
+    ok = addPath( w, child ) && ok;
+    free( child );
+  }
+  closedir( dir );
+  return ok;
+}
+
+/**
+  Forgets every file and scans everything named on the command line
+  again.  This is how the totals are put right after the kernel drops
+  events because its queue filled up.
+
+  @param w the watch state.
+*/
+static void rescanAll( Watch *w )
+{
+  for ( size_t i = 0; i < w->bucketCount; i++ ) {
+    Entry *e = w->buckets[ i ];
+    while ( e ) {
+      Entry *next = e->next;
+      free( e->path );
+      free( e );
+      e = next;
+    }
+    w->buckets[ i ] = NULL;
+  }
+  w->fileCount = 0;
+  w->chars = w->commentChars = w->comments = w->unterminated = 0;
+
+  // A file's directory is watched again in case its watch went away
+  for ( int i = 0; i < w->rootCount; i++ ) {
+    struct stat st;
+    if ( lstat( w->roots[ i ], &st ) == 0 && S_ISREG( st.st_mode ) )
+      free( watchParent( w, w->roots[ i ] ) );
+    addPath( w, w->roots[ i ] );
+  }
+}
+
+/**
+  Handles all the inotify events in a buffer.
+
+  @param w the watch state.
+  @param buf the events read from the inotify descriptor.
+  @param len number of bytes read.
+*/
+static void handleEvents( Watch *w, const char *buf, ssize_t len )
+{
+  bool overflow = false;
+  const char *p = buf;
+  while ( p < buf + len ) {
+    const struct inotify_event *ev = (const struct inotify_event *) p;
+    p += sizeof( struct inotify_event ) + ev->len;
+
+    if ( ev->mask & IN_Q_OVERFLOW ) {
+      overflow = true;
+      continue;
+    }
+    if ( ev->wd < 0 || ev->wd >= w->dirCap || w->dirs[ ev->wd ] == NULL )
+      continue;
+    if ( ev->mask & IN_IGNORED ) {
+      free( w->dirs[ ev->wd ] );
+      w->dirs[ ev->wd ] = NULL;
+      continue;
+    }
+    if ( ev->len == 0 )
+      continue;
+
+    const char *dir = w->dirs[ ev->wd ];
+    size_t size = strlen( dir ) + strlen( ev->name ) + 2;
+    char *path = (char *) malloc( size );
+    if ( path == NULL ) {
+      // An event we can't handle is as good as dropped.
+      overflow = true;
+      continue;
+    }
+    snprintf( path, size, "%s/%s", dir, ev->name );
+    if ( w->partial[ ev->wd ] && !isRoot( w, path ) ) {
+      free( path );
+      continue;
+    }
+
+    bool isDir = ( ev->mask & IN_ISDIR ) != 0;
+    if ( ev->mask & REMOVE_EVENTS ) {
+      removePath( w, path, isDir );
+    } else if ( isDir ) {
+      if ( ev->mask & ( IN_CREATE | IN_MOVED_TO ) )
+        addPath( w, path );
+    } else if ( ev->mask & ( IN_CLOSE_WRITE | IN_MOVED_TO ) ) {
+      // A file that vanished again before we got to it is just forgotten.
+      if ( !addPath( w, path ) )
+        removePath( w, path, false );
+    }
+
+    free( path );
+  }
+
+  if ( overflow )
+    rescanAll( w );
+}
+
+/**
+  Sends the current totals to a client and closes the connection.
+
+  @param w the watch state.
+  @param fd the connected socket.
+*/
+static void sendReport( Watch *w, int fd )
+{
+  char report[ REPORT_LEN ];
+  double percent = w->chars > 0 ? (double) w->commentChars / w->chars * PERCENT : 0.0;
+  int len = snprintf( report, sizeof( report ),
+                      "Input characters: %lld\nComments: %lld (%.2f%%)\n"
+                      "Files: %zu\nUnterminated: %lld\n",
+                      w->chars, w->comments, percent, w->fileCount, w->unterminated );
+
+  const char *p = report;
+  while ( len > 0 ) {
+    ssize_t n = write( fd, p, len );
+    if ( n < 0 && errno == EINTR )
+      continue;
+    if ( n <= 0 )
+      break;
+    p += n;
+    len -= n;
+  }
+  close( fd );
+}
+
+/**
+  Creates the listening Unix domain socket.
+
+  @param path where to create the socket.
+  @return the socket, or -1 on failure.
+*/
+static int listenOn( const char *path )
+{
+  struct sockaddr_un addr;
+  if ( strlen( path ) >= sizeof( addr.sun_path ) )
+    return -1;
+
+  int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+  if ( fd < 0 )
+    return -1;
+
+  memset( &addr, 0, sizeof( addr ) );
+  addr.sun_family = AF_UNIX;
+  strcpy( addr.sun_path, path );
+  unlink( path );
+  if ( bind( fd, (struct sockaddr *) &addr, sizeof( addr ) ) != 0
+       || listen( fd, SOMAXCONN ) != 0 ) {
+    close( fd );
+    return -1;
+  }
+  return fd;
+}
+
+int watchTree( int count, char *paths[], const char *socketPath, Cache *cache )
+{
+  Watch w = { 0 };
+  w.bucketCount = INITIAL_BUCKETS;
+  w.buckets = (Entry **) calloc( w.bucketCount, sizeof( Entry * ) );
+  w.roots = (char **) malloc( ( count > 0 ? count : 1 ) * sizeof( char * ) );
+  if ( w.buckets == NULL || w.roots == NULL ) {
+    fprintf( stderr, "Not enough memory to watch files\n" );
+    free( w.buckets );
+    free( w.roots );
+    return EXIT_FAILURE;
+  }
+  w.cache = cache;
+  w.inotifyFd = inotify_init();
+  if ( w.inotifyFd < 0 ) {
+    fprintf( stderr, "Can't start inotify\n" );
+    free( w.buckets );
+    free( w.roots );
+    return EXIT_FAILURE;
+  }
+
+  // Files are watched through their directories, since inotify only
+  // reports a file being replaced or created to its directory
+  for ( int i = 0; i < count; i++ ) {
+    struct stat st;
+    bool file = lstat( paths[ i ], &st ) == 0 && S_ISREG( st.st_mode );
+    char *root = file ? watchParent( &w, paths[ i ] ) : strdup( paths[ i ] );
+    if ( root )
+      w.roots[ w.rootCount++ ] = root;
+    if ( root == NULL || !addPath( &w, root ) )
+      fprintf( stderr, "Can't watch: %s\n", paths[ i ] );
+  }
+
+  // Later rescans aren't recorded in the cache, or it would grow with
+  // every save for as long as we run.
+  w.cache = NULL;
+
+  int sock = listenOn( socketPath );
+  if ( sock < 0 ) {
+    fprintf( stderr, "Can't create socket: %s\n", socketPath );
+    return EXIT_FAILURE;
+  }
+
+  struct sigaction sa;
+  memset( &sa, 0, sizeof( sa ) );
+  sa.sa_handler = requestStop;
+  sigaction( SIGINT, &sa, NULL );
+  sigaction( SIGTERM, &sa, NULL );
+  signal( SIGPIPE, SIG_IGN );
+
+  static char events[ EVENT_BUFFER ]
+    __attribute__(( aligned( __alignof__( struct inotify_event ) ) ));
+  struct pollfd fds[ 2 ] = { { w.inotifyFd, POLLIN, 0 }, { sock, POLLIN, 0 } };
+
+  while ( !stopRequested ) {
+    if ( poll( fds, 2, -1 ) < 0 )
+      continue;
+
+    if ( fds[ 0 ].revents & POLLIN ) {
+      ssize_t len = read( w.inotifyFd, events, sizeof( events ) );
+      if ( len > 0 )
+        handleEvents( &w, events, len );
+    }
+
+    if ( fds[ 1 ].revents & POLLIN ) {
+      int client = accept( sock, NULL, NULL );
+      if ( client >= 0 )
+        sendReport( &w, client );
+    }
+  }
+
+  close( sock );
+  unlink( socketPath );
+  close( w.inotifyFd );
+
+  for ( size_t i = 0; i < w.bucketCount; i++ ) {
+    Entry *e = w.buckets[ i ];
+    while ( e ) {
+      Entry *next = e->next;
+      free( e->path );
+      free( e );
+      e = next;
+    }
+  }
+  free( w.buckets );
+  for ( int i = 0; i < w.dirCap; i++ )
+    free( w.dirs[ i ] );
+  free( w.dirs );
+  free( w.partial );
+  for ( int i = 0; i < w.rootCount; i++ )
+    free( w.roots[ i ] );
+  free( w.roots );
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,34 @@
+/**
+  @file watch.h
+  @author Jesse Liddle (jaliddl2)
+
+  Watch mode for the comments program.  It keeps comment statistics for
+  every file in a set of directory trees, rescans only the files that
+  inotify reports as changed, and serves the current totals to anyone
+  who connects to a Unix domain socket.
+*/
+
+#ifndef _WATCH_H_
+#define _WATCH_H_
+
+#include "cache.h"
+
+/**
+  Watches the given files and directory trees until the program gets
+  SIGINT or SIGTERM.  Each connection to the socket gets one report of
+  the current totals in the same format the comments program prints,
+  followed by the number of files and the number of files that end
+  inside a comment.  A file is watched through its directory, so it's
+  picked up again when an editor replaces it.  If the kernel drops
+  events, everything is scanned again.
+
+  @param count number of paths to watch.
+  @param paths the files and directories to watch.
+  @param socketPath where to create the Unix domain socket.
+  @param cache cache used to skip unchanged files in the initial scan,
+  or NULL.  The initial scan is recorded in it.
+  @return an exit status for the program.
+*/
+int watchTree( int count, char *paths[], const char *socketPath, Cache *cache );
+
+#endif
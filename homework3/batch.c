@@ -0,0 +1,270 @@
+/**
+  @file batch.c
+  @author Jesse Liddle (jaliddl2)
+
+  This file runs batches of drawing jobs.
+*/
+#include "batch.h"
+#include "mapfile.h"
+#include "script.h"
+#include "render.h"
+#include "cull.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+//Color a canvas is cleared to before each job
+#define CLEAR_COLOR 255
+
+//Size of the stdio buffer each worker writes its images through
+#define IO_BUFFER ( 1 << 16 )
+
+//First number of jobs a manifest has room for
+#define INITIAL_JOBS 64
+
+//One job from a manifest
+typedef struct {
+  char *script;
+  char *output;
+} Job;
+
+//State shared by the worker threads
+typedef struct {
+  const BatchOptions *opts;
+  Job *jobs;
+  int count;
+  
+  //Next job that hasn't been taken yet, and the number that failed
+  int next;
+  int failed;
+  pthread_mutex_t lock;
+} Batch;
+
+/**
+  This function copies a word of the manifest into its own string.
+  
+  @param start The start of the word.
+  @param end One past the end of the word.
+  @return The new string, which the caller frees, or NULL if there
+  isn't enough memory.
+*/
+static char *copyWord( const char *start, const char *end )
+{
+  char *word = (char *) malloc( end - start + 1 );
+  if ( word == NULL )
+    return NULL;
+  memcpy( word, start, end - start );
+  word[ end - start ] = '\0';
+  return word;
+}
+
+/**
+  This function reads a manifest into a list of jobs.  Each line that
+  isn't blank must have exactly two words, the script and the image.
+  
+  @param manifest The manifest file.
+  @param batch The batch to fill in with the jobs, which the caller
+  frees with freeJobs() whether or not this worked.
+  @return Zero if it worked, BATCH_INVALID if a line doesn't have two
+  words or BATCH_NO_MEMORY if there isn't enough memory for the jobs.
+*/
+static int readManifest( FILE *manifest, Batch *batch )
+{
+  MappedFile mf;
+  int capacity = 0;
+  batch->jobs = NULL;
+  batch->count = 0;
+  if ( !mapFile( manifest, &mf ) )
+    return BATCH_INVALID;
+  
+  int status = 0;
+  const char *p = mf.data;
+  const char *end = mf.data + mf.len;
+  while ( status == 0 && p < end ) {
+    const char *eol = memchr( p, '\n', end - p );
+    if ( eol == NULL )
+      eol = end;
+    
+    //Splits the line into words
+    const char *words[ 3 ][ 2 ];
+    int n = 0;
+    while ( p < eol ) {
+      while ( p < eol && ( *p == ' ' || *p == '\t' || *p == '\r' ) )
+        p++;
+      if ( p == eol )
+        break;
+      const char *w = p;
+      while ( p < eol && *p != ' ' && *p != '\t' && *p != '\r' )
+        p++;
+      if ( n < 3 ) {
+        words[ n ][ 0 ] = w;
+        words[ n ][ 1 ] = p;
+      }
+      n++;
+    }
+    p = eol + 1;
+    
+    if ( n == 0 )
+      continue;
+    if ( n != 2 ) {
+      status = BATCH_INVALID;
+      break;
+    }
+    
+    if ( batch->count == capacity ) {
+      int bigger = capacity ? capacity * 2 : INITIAL_JOBS;
+      Job *jobs = (Job *) realloc( batch->jobs, bigger * sizeof( Job ) );
+      if ( jobs == NULL ) {
+        status = BATCH_NO_MEMORY;
+        break;
+      }
+      batch->jobs = jobs;
+      capacity = bigger;
+    }
+    Job *job = batch->jobs + batch->count++;
+    job->script = copyWord( words[ 0 ][ 0 ], words[ 0 ][ 1 ] );
+    job->output = copyWord( words[ 1 ][ 0 ], words[ 1 ][ 1 ] );
+    if ( job->script == NULL || job->output == NULL )
+      status = BATCH_NO_MEMORY;
+  }
+  
+  unmapFile( &mf );
+  return status;
+}
+
+/**
+  This function frees the jobs of a batch.
+  
+  @param batch The batch.
+*/
+static void freeJobs( Batch *batch )
+{
+  for ( int i = 0; i < batch->count; i++ ) {
+    free( batch->jobs[ i ].script );
+    free( batch->jobs[ i ].output );
+  }
+  free( batch->jobs );
+}
+
+/**
+  This function runs one job.
+  
+  @param job The job.
+  @param opts The settings for the job.
+  @param image The worker's canvas, cleared and drawn on.
+  @param buffer The worker's output buffer, IO_BUFFER bytes.
+  @return False if the job failed, after reporting why.
+*/
+static bool runJob( const Job *job, const BatchOptions *opts, Canvas *image,
+                    char *buffer )
+{
+  FILE *inputF = fopen( job->script, "r" );
+  if ( inputF == NULL ) {
+    fprintf(stderr, "Can't open file: %s\n", job->script);
+    return false;
+  }
+  
+  Script script;
+  bool valid = readScript( inputF, &script );
+  fclose( inputF );
+  if ( !valid ) {
+    fprintf(stderr, "Invalid script file: %s\n", job->script);
+    freeScript( &script );
+    return false;
+  }
+  
+  FILE *outputF = fopen( job->output, "w" );
+  if ( outputF == NULL ) {
+    fprintf(stderr, "Can't open file: %s\n", job->output);
+    freeScript( &script );
+    return false;
+  }
+  setvbuf( outputF, buffer, _IOFBF, IO_BUFFER );
+  
+  if ( opts->cull )
+    cullScript( image->width, image->height, &script );
+  clearImage( image, CLEAR_COLOR );
+  renderScript( image, &script, 1 );
+  saveImage( image, outputF, opts->format );
+  freeScript( &script );
+  
+  if ( fclose( outputF ) != 0 ) {
+    fprintf(stderr, "Can't write file: %s\n", job->output);
+    return false;
+  }
+  return true;
+}
+
+/**
+  This function is run by each worker thread.  It keeps taking the next
+  job until there are none left, drawing them all on one canvas.
+  
+  @param arg The shared Batch.
+  @return Always NULL.
+*/
+static void *runJobs( void *arg )
+{
+  Batch *batch = (Batch *) arg;
+  const BatchOptions *opts = batch->opts;
+  Canvas *image = makeCanvas( opts->width, opts->height );
+  char *buffer = (char *) malloc( IO_BUFFER );
+  
+  while ( true ) {
+    pthread_mutex_lock( &batch->lock );
+    int k = batch->next++;
+    pthread_mutex_unlock( &batch->lock );
+    if ( k >= batch->count )
+      break;
+    
+    bool ok;
+    if ( image == NULL || buffer == NULL ) {
+      fprintf(stderr, "Can't make a %dx%d image\n", opts->width, opts->height);
+      ok = false;
+    } else {
+      ok = runJob( batch->jobs + k, opts, image, buffer );
+    }
+    
+    if ( !ok ) {
+      pthread_mutex_lock( &batch->lock );
+      batch->failed++;
+      pthread_mutex_unlock( &batch->lock );
+    }
+  }
+  
+  if ( image )
+    freeCanvas( image );
+  free( buffer );
+  return NULL;
+}
+
+int runBatch( FILE *manifest, const BatchOptions *opts )
+{
+  Batch batch;
+  int status = readManifest( manifest, &batch );
+  if ( status != 0 ) {
+    freeJobs( &batch );
+    return status;
+  }
+  
+  batch.opts = opts;
+  batch.next = 0;
+  batch.failed = 0;
+  pthread_mutex_init( &batch.lock, NULL );
+  
+  //No more threads are started than there are jobs, and the calling
+  //thread works on jobs too
+  int threads = opts->threads < batch.count ? opts->threads : batch.count;
+  pthread_t *ids = (pthread_t *) malloc( ( threads > 1 ? threads : 1 ) * sizeof( pthread_t ) );
+  int started = 0;
+  while ( ids && started < threads - 1
+          && pthread_create( ids + started, NULL, runJobs, &batch ) == 0 )
+    started++;
+  runJobs( &batch );
+  for ( int i = 0; i < started; i++ )
+    pthread_join( ids[ i ], NULL );
+  
+  free( ids );
+  pthread_mutex_destroy( &batch.lock );
+  freeJobs( &batch );
+  return batch.failed;
+}
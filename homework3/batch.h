@@ -0,0 +1,51 @@
+/**
+  @file batch.h
+  @author Jesse Liddle (jaliddl2)
+
+  Draws many scripts in one run of the program.  A manifest lists one
+  job per line, a script file and the image file to draw it to, and a
+  pool of threads works through the jobs.
+*/
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "image.h"
+
+//What runBatch() returns when the manifest isn't valid, and when there
+//isn't enough memory to hold its jobs
+#define BATCH_INVALID -1
+#define BATCH_NO_MEMORY -2
+
+//Settings shared by every job in a batch
+typedef struct {
+  //Size of every picture
+  int width;
+  int height;
+  
+  //Format of every image written
+  ImageFormat format;
+  
+  //Whether to drop hidden commands before drawing
+  bool cull;
+  
+  //Number of jobs drawn at once
+  int threads;
+} BatchOptions;
+
+/**
+  This function runs every job in a manifest.  Blank lines are skipped.
+  Each thread keeps its own canvas and output buffer from one job to the
+  next.  A job that fails reports why on standard error, naming its
+  script, and the rest of the batch still runs.
+  
+  @param manifest The manifest file.
+  @param opts The settings for the jobs.
+  @return The number of jobs that failed, or BATCH_INVALID if the
+  manifest itself isn't valid or BATCH_NO_MEMORY if its jobs couldn't
+  be held in memory.
+*/
+int runBatch( FILE *manifest, const BatchOptions *opts );
+
+#endif
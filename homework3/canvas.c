@@ -0,0 +1,255 @@
+/**
+  @file canvas.c
+  @author Jesse Liddle (jaliddl2)
+
+  This file creates and frees the canvas, and has the kernels that fill
+  runs of pixels.
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include "canvas.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+
+#if defined( __AVX2__ ) || defined( __SSE2__ )
+#include <immintrin.h>
+#endif
+
+Canvas *makeCanvas( int width, int height )
+{
+  if ( width <= 0 || height <= 0 )
+    return NULL;
+  
+  //Rounds each row up to a whole number of aligned blocks
+  size_t stride = ( (size_t) width + CANVAS_ALIGN - 1 ) / CANVAS_ALIGN * CANVAS_ALIGN;
+  if ( stride > SIZE_MAX / (size_t) height )
+    return NULL;
+  
+  Canvas *canvas = (Canvas *) malloc( sizeof( Canvas ) );
+  if ( canvas == NULL )
+    return NULL;
+  
+  void *pixels;
+  if ( posix_memalign( &pixels, CANVAS_ALIGN, stride * height ) != 0 ) {
+    free( canvas );
+    return NULL;
+  }
+  
+  canvas->width = width;
+  canvas->height = height;
+  canvas->originX = 0;
+  canvas->originY = 0;
+  canvas->stride = stride;
+  canvas->pixels = (unsigned char *) pixels;
+  canvas->dirty = NULL;
+  return canvas;
+}
+
+void freeCanvas( Canvas *canvas )
+{
+  free( canvas->pixels );
+  free( canvas->dirty );
+  free( canvas );
+}
+
+bool trackChanges( Canvas *canvas )
+{
+  free( canvas->dirty );
+  canvas->dirty = (unsigned char *) calloc( canvas->height, 1 );
+  return canvas->dirty != NULL;
+}
+
+RgbCanvas *makeRgbCanvas( int width, int height )
+{
+  RgbCanvas *canvas = (RgbCanvas *) calloc( 1, sizeof( RgbCanvas ) );
+  if ( canvas == NULL )
+    return NULL;
+  canvas->width = width;
+  canvas->height = height;
+  for ( int p = 0; p < RGB_PLANES; p++ ) {
+    if ( ( canvas->planes[ p ] = makeCanvas( width, height ) ) == NULL ) {
+      freeRgbCanvas( canvas );
+      return NULL;
+    }
+  }
+  return canvas;
+}
+
+RgbCanvas *copyToRgb( const Canvas *grey )
+{
+  RgbCanvas *canvas = makeRgbCanvas( grey->width, grey->height );
+  if ( canvas == NULL )
+    return NULL;
+  for ( int p = 0; p < RGB_PLANES; p++ )
+    for ( int y = 0; y < grey->height; y++ )
+      memcpy( canvasRow( canvas->planes[ p ], y ), canvasRow( grey, y ), grey->width );
+  return canvas;
+}
+
+void freeRgbCanvas( RgbCanvas *canvas )
+{
+  for ( int p = 0; p < RGB_PLANES; p++ )
+    if ( canvas->planes[ p ] )
+      freeCanvas( canvas->planes[ p ] );
+  free( canvas );
+}
+
+TiledCanvas *makeTiledCanvas( int width, int height, unsigned char color )
+{
+  if ( width <= 0 || height <= 0 )
+    return NULL;
+  
+  int cols = ( width - 1 ) / TILE_SIZE + 1;
+  int rows = ( height - 1 ) / TILE_SIZE + 1;
+  if ( (size_t) cols > INT_MAX / (size_t) rows )
+    return NULL;
+  
+  TiledCanvas *canvas = (TiledCanvas *) malloc( sizeof( TiledCanvas ) );
+  if ( canvas == NULL )
+    return NULL;
+  canvas->width = width;
+  canvas->height = height;
+  canvas->cols = cols;
+  canvas->rows = rows;
+  canvas->tiles = (unsigned char **) calloc( (size_t) cols * rows, sizeof( unsigned char * ) );
+  canvas->solid = (unsigned char *) malloc( (size_t) cols * rows );
+  if ( canvas->tiles == NULL || canvas->solid == NULL ) {
+    free( canvas->tiles );
+    free( canvas->solid );
+    free( canvas );
+    return NULL;
+  }
+  
+  memset( canvas->solid, color, (size_t) cols * rows );
+  return canvas;
+}
+
+void freeTiledCanvas( TiledCanvas *canvas )
+{
+  for ( int k = 0; k < canvas->cols * canvas->rows; k++ )
+    free( canvas->tiles[ k ] );
+  free( canvas->tiles );
+  free( canvas->solid );
+  free( canvas );
+}
+
+void tileRect( const TiledCanvas *canvas, int k, Rect *r )
+{
+  r->x0 = k % canvas->cols * TILE_SIZE;
+  r->y0 = k / canvas->cols * TILE_SIZE;
+  r->x1 = canvas->width - r->x0 > TILE_SIZE ? r->x0 + TILE_SIZE : canvas->width;
+  r->y1 = canvas->height - r->y0 > TILE_SIZE ? r->y0 + TILE_SIZE : canvas->height;
+}
+
+bool openTile( TiledCanvas *canvas, int k, Canvas *view )
+{
+  if ( canvas->tiles[ k ] == NULL ) {
+    void *pixels;
+    if ( posix_memalign( &pixels, CANVAS_ALIGN, TILE_SIZE * TILE_SIZE ) != 0 )
+      return false;
+    memset( pixels, canvas->solid[ k ], TILE_SIZE * TILE_SIZE );
+    canvas->tiles[ k ] = (unsigned char *) pixels;
+  }
+  
+  Rect r;
+  tileRect( canvas, k, &r );
+  view->width = r.x1 - r.x0;
+  view->height = r.y1 - r.y0;
+  view->originX = r.x0;
+  view->originY = r.y0;
+  view->stride = TILE_SIZE;
+  view->pixels = canvas->tiles[ k ];
+  view->dirty = NULL;
+  return true;
+}
+
+void setTileColor( TiledCanvas *canvas, int k, unsigned char color )
+{
+  free( canvas->tiles[ k ] );
+  canvas->tiles[ k ] = NULL;
+  canvas->solid[ k ] = color;
+}
+
+/**
+  This function sets a run of bytes to one value.  Short runs use a pair
+  of overlapping word stores.  Long runs use one unaligned vector store
+  for the start, aligned stores for the middle and one more unaligned
+  store that ends exactly at the end of the run.
+  
+  @param p The first byte to set.
+  @param n Number of bytes to set.
+  @param color The value to set them to.
+*/
+static inline void fillBytes( unsigned char *p, size_t n, unsigned char color )
+{
+#if defined( __AVX2__ ) || defined( __SSE2__ )
+  unsigned char *end = p + n;
+  if ( n < 16 ) {
+    uint64_t w = 0x0101010101010101ull * color;
+    if ( n >= 8 ) {
+      memcpy( p, &w, 8 );
+      memcpy( end - 8, &w, 8 );
+    } else if ( n >= 4 ) {
+      memcpy( p, &w, 4 );
+      memcpy( end - 4, &w, 4 );
+    } else {
+      while ( p < end )
+        *p++ = color;
+    }
+    return;
+  }
+  
+#if defined( __AVX2__ )
+  if ( n >= 32 ) {
+    __m256i v = _mm256_set1_epi8( (char) color );
+    _mm256_storeu_si256( (__m256i *) p, v );
+    unsigned char *q = (unsigned char *) ( ( (uintptr_t) p + 32 ) & ~(uintptr_t) 31 );
+    for ( ; q + 32 <= end; q += 32 )
+      _mm256_store_si256( (__m256i *) q, v );
+    _mm256_storeu_si256( (__m256i *) ( end - 32 ), v );
+    return;
+  }
+#endif
+  
+  __m128i v = _mm_set1_epi8( (char) color );
+  _mm_storeu_si128( (__m128i *) p, v );
+  unsigned char *q = (unsigned char *) ( ( (uintptr_t) p + 16 ) & ~(uintptr_t) 15 );
+  for ( ; q + 16 <= end; q += 16 )
+    _mm_store_si128( (__m128i *) q, v );
+  _mm_storeu_si128( (__m128i *) ( end - 16 ), v );
+#else
+  memset( p, color, n );
+#endif
+}
+
+void fillSpan( Canvas *canvas, int y, int x0, int x1, unsigned char color )
+{
+  if ( x1 > x0 )
+    fillBytes( canvasPixel( canvas, x0, y ), x1 - x0, color );
+}
+
+void fillRect( Canvas *canvas, const Rect *r, unsigned char color )
+{
+  if ( r->x1 <= r->x0 || r->y1 <= r->y0 )
+    return;
+  
+  //Rectangles as wide as the canvas are one run of memory, since the
+  //padding at the end of each row can be set too
+  if ( r->x0 == canvas->originX && r->x1 - r->x0 == canvas->width ) {
+    size_t n = (size_t) ( r->y1 - r->y0 - 1 ) * canvas->stride + canvas->width;
+    fillBytes( canvasRow( canvas, r->y0 ), n, color );
+    return;
+  }
+  
+  for ( int k = r->y0; k < r->y1; k++ )
+    fillBytes( canvasPixel( canvas, r->x0, k ), r->x1 - r->x0, color );
+}
+
+void clearCanvas( Canvas *canvas, unsigned char color )
+{
+  Rect all = { canvas->originX, canvas->originY,
+               canvas->originX + canvas->width, canvas->originY + canvas->height };
+  fillRect( canvas, &all, color );
+}
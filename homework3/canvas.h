@@ -0,0 +1,267 @@
+/**
+  @file canvas.h
+  @author Jesse Liddle (jaliddl2)
+
+  The canvas the drawing program draws on.  Its size is chosen at run
+  time, and its pixels are stored a row at a time in one aligned block
+  of memory, so walking along a row touches memory in order.  Runs of
+  pixels are filled with wide vector stores where the compiler targets
+  SSE2 or AVX2, and with memset otherwise.
+*/
+#ifndef _CANVAS_H_
+#define _CANVAS_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+//Default size of the canvas, matching the images the tests expect
+#define DEFAULT_WIDTH 255
+#define DEFAULT_HEIGHT 255
+
+//Alignment of the pixel memory and of every row, in bytes
+#define CANVAS_ALIGN 64
+
+//Size of the square tiles the canvas is divided into for binning work
+#define TILE_SIZE 64
+
+//A rectangle of pixels, from (x0, y0) up to but not including (x1, y1)
+typedef struct {
+  int x0;
+  int y0;
+  int x1;
+  int y1;
+} Rect;
+
+//A greyscale canvas.  It can also be a view of one part of a bigger
+//picture, like a tile, in which case its pixels start at the origin
+//instead of at (0, 0).
+typedef struct {
+  //Size of the canvas in pixels
+  int width;
+  int height;
+  
+  //Picture coordinates of the first pixel
+  int originX;
+  int originY;
+  
+  //Number of bytes from the start of one row to the start of the next
+  size_t stride;
+  
+  //The pixels, row by row
+  unsigned char *pixels;
+  
+  //One flag for each row, set when something is drawn in the row, or
+  //NULL if changes aren't being tracked
+  unsigned char *dirty;
+} Canvas;
+
+/**
+  This function makes a new canvas of the given size.  Its pixels are
+  not cleared.
+  
+  @param width The width of the canvas in pixels.
+  @param height The height of the canvas in pixels.
+  @return The new canvas, or NULL if the size isn't valid or there
+  isn't enough memory.  The caller frees it with freeCanvas().
+*/
+Canvas *makeCanvas( int width, int height );
+
+/**
+  This function frees a canvas and its pixels.
+  
+  @param canvas The canvas to free.
+*/
+void freeCanvas( Canvas *canvas );
+
+/**
+  This function starts keeping track of which rows of a canvas get
+  drawn on, with every row starting out clean.
+  
+  @param canvas The canvas.
+  @return False if there isn't enough memory.
+*/
+bool trackChanges( Canvas *canvas );
+
+/**
+  This function marks some rows of a canvas as changed, if its changes
+  are being tracked.
+  
+  @param canvas The canvas.
+  @param y0 The first row that changed.
+  @param y1 One past the last row that changed.
+*/
+static inline void markRows( Canvas *canvas, int y0, int y1 )
+{
+  if ( canvas->dirty && y1 > y0 )
+    memset( canvas->dirty + ( y0 - canvas->originY ), 1, y1 - y0 );
+}
+
+/**
+  This function sets a run of pixels in one row to a color.
+  
+  @param canvas The canvas to draw on.
+  @param y The row, which must be on the canvas.
+  @param x0 The first pixel to set.
+  @param x1 One past the last pixel to set.  Nothing is set unless it
+  is more than x0, and it must not be past the end of the row.
+  @param color The color to set the pixels to.
+*/
+void fillSpan( Canvas *canvas, int y, int x0, int x1, unsigned char color );
+
+/**
+  This function sets every pixel in a rectangle to a color.
+  
+  @param canvas The canvas to draw on.
+  @param r The rectangle, which must be on the canvas.
+  @param color The color to set the pixels to.
+*/
+void fillRect( Canvas *canvas, const Rect *r, unsigned char color );
+
+/**
+  This function sets every pixel of a canvas to a color.
+  
+  @param canvas The canvas to clear.
+  @param color The color to set the pixels to.
+*/
+void clearCanvas( Canvas *canvas, unsigned char color );
+
+/**
+  This function returns the start of a row of the canvas.
+  
+  @param canvas The canvas.
+  @param y The row, which must be on the canvas.
+  @return A pointer to the first pixel of the row.
+*/
+static inline unsigned char *canvasRow( const Canvas *canvas, int y )
+{
+  return canvas->pixels + (size_t) ( y - canvas->originY ) * canvas->stride;
+}
+
+/**
+  This function returns one pixel of the canvas.
+  
+  @param canvas The canvas.
+  @param x The column, which must be on the canvas.
+  @param y The row, which must be on the canvas.
+  @return A pointer to the pixel.
+*/
+static inline unsigned char *canvasPixel( const Canvas *canvas, int x, int y )
+{
+  return canvasRow( canvas, y ) + ( x - canvas->originX );
+}
+
+//Number of planes in a color canvas, red, green and blue
+#define RGB_PLANES 3
+
+//A color canvas, kept as a separate greyscale plane for each of red,
+//green and blue instead of with the three bytes of each pixel next to
+//each other, so a run of pixels is still one run of bytes in each plane
+//and is filled the same way as on a greyscale canvas.
+typedef struct {
+  //Size of the canvas in pixels
+  int width;
+  int height;
+  
+  //The red, green and blue planes
+  Canvas *planes[ RGB_PLANES ];
+} RgbCanvas;
+
+/**
+  This function makes a new color canvas of the given size.  Its pixels
+  are not cleared.
+  
+  @param width The width of the canvas in pixels.
+  @param height The height of the canvas in pixels.
+  @return The new canvas, or NULL if the size isn't valid or there
+  isn't enough memory.  The caller frees it with freeRgbCanvas().
+*/
+RgbCanvas *makeRgbCanvas( int width, int height );
+
+/**
+  This function makes a color canvas with the same pixels as a
+  greyscale one, copied into all three planes.
+  
+  @param grey The greyscale canvas.
+  @return The new canvas, or NULL if there isn't enough memory.  The
+  caller frees it with freeRgbCanvas().
+*/
+RgbCanvas *copyToRgb( const Canvas *grey );
+
+/**
+  This function frees a color canvas and its planes.
+  
+  @param canvas The canvas to free.
+*/
+void freeRgbCanvas( RgbCanvas *canvas );
+
+//A canvas split into tiles that only get pixels once something is drawn
+//on them.  Until then a tile is just one solid color, so a huge picture
+//that is mostly background takes very little memory.
+typedef struct {
+  //Size of the canvas in pixels
+  int width;
+  int height;
+  
+  //Size of the canvas in tiles
+  int cols;
+  int rows;
+  
+  //Pixels of each tile, TILE_SIZE rows of TILE_SIZE, or NULL if the
+  //tile is solid
+  unsigned char **tiles;
+  
+  //Color of each tile that is solid
+  unsigned char *solid;
+} TiledCanvas;
+
+/**
+  This function makes a new tiled canvas with every tile solid.
+  
+  @param width The width of the canvas in pixels.
+  @param height The height of the canvas in pixels.
+  @param color The color every pixel starts out as.
+  @return The new canvas, or NULL if the size isn't valid or there
+  isn't enough memory.  The caller frees it with freeTiledCanvas().
+*/
+TiledCanvas *makeTiledCanvas( int width, int height, unsigned char color );
+
+/**
+  This function frees a tiled canvas and all of its tiles.
+  
+  @param canvas The canvas to free.
+*/
+void freeTiledCanvas( TiledCanvas *canvas );
+
+/**
+  This function finds the pixels a tile covers.  Tiles on the right and
+  bottom edges can be smaller than the others.
+  
+  @param canvas The tiled canvas.
+  @param k The number of the tile, counting across each row of tiles.
+  @param r Filled in with the pixels of the tile.
+*/
+void tileRect( const TiledCanvas *canvas, int k, Rect *r );
+
+/**
+  This function gets a tile ready to be drawn on, giving it its own
+  pixels in its solid color if it doesn't have any yet.
+  
+  @param canvas The tiled canvas.
+  @param k The number of the tile.
+  @param view Filled in with a canvas covering just the tile, in the
+  coordinates of the whole picture.
+  @return False if there isn't enough memory.
+*/
+bool openTile( TiledCanvas *canvas, int k, Canvas *view );
+
+/**
+  This function makes a tile solid, freeing its pixels if it had any.
+  
+  @param canvas The tiled canvas.
+  @param k The number of the tile.
+  @param color The new color of the whole tile.
+*/
+void setTileColor( TiledCanvas *canvas, int k, unsigned char color );
+
+#endif
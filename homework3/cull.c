@@ -0,0 +1,100 @@
+/**
+  @file cull.c
+  @author Jesse Liddle (jaliddl2)
+
+  This file drops commands that are hidden by later ones.
+*/
+#include "cull.h"
+#include "render.h"
+#include <stdlib.h>
+
+/**
+  This function tells if a command paints every pixel of a rectangle.
+  Only circles and filled rectangles are checked.  A circle paints
+  exactly the pixels closer than its radius to its center, and that set
+  has no dents, so it is enough to check the corners of the rectangle.
+*/
+bool commandCovers( const Command *cmd, const Rect *r )
+{
+  if ( cmd->op == OP_RECT ) {
+    const int *a = cmd->args;
+    return ( a[0] < a[2] ? a[0] : a[2] ) <= r->x0
+      && ( a[0] < a[2] ? a[2] : a[0] ) >= r->x1
+      && ( a[1] < a[3] ? a[1] : a[3] ) <= r->y0
+      && ( a[1] < a[3] ? a[3] : a[1] ) >= r->y1;
+  }
+  if ( cmd->op != OP_CIRCLE )
+    return false;
+  
+  long long cx = cmd->args[0];
+  long long cy = cmd->args[1];
+  long long rsqrd = (long long) cmd->args[2] * cmd->args[2];
+  long long xs[ 2 ] = { r->x0 - cx, r->x1 - 1 - cx };
+  long long ys[ 2 ] = { r->y0 - cy, r->y1 - 1 - cy };
+  
+  for ( int i = 0; i < 2; i++ )
+    for ( int j = 0; j < 2; j++ )
+      if ( xs[ i ] * xs[ i ] + ys[ j ] * ys[ j ] >= rsqrd )
+        return false;
+  return true;
+}
+
+int cullScript( int width, int height, Script *script )
+{
+  int cols = ( width + TILE_SIZE - 1 ) / TILE_SIZE;
+  int rows = ( height + TILE_SIZE - 1 ) / TILE_SIZE;
+  bool *covered = (bool *) calloc( (size_t) cols * rows, sizeof( bool ) );
+  bool *keep = (bool *) malloc( script->count + 1 );
+  //Culling is only a shortcut, so without memory for it nothing is dropped
+  if ( covered == NULL || keep == NULL ) {
+    free( keep );
+    free( covered );
+    return 0;
+  }
+  int culled = 0;
+  
+  for ( int i = script->count - 1; i >= 0; i-- ) {
+    const Command *cmd = script->cmds + i;
+    Rect box;
+    keep[ i ] = false;
+    if ( !commandBounds( width, height, script, cmd, &box ) ) {
+      culled++;
+      continue;
+    }
+    
+    //Looks for a tile the command touches that isn't painted yet, and
+    //marks the tiles it paints completely
+    int c0 = box.x0 / TILE_SIZE;
+    int r0 = box.y0 / TILE_SIZE;
+    int c1 = ( box.x1 - 1 ) / TILE_SIZE;
+    int r1 = ( box.y1 - 1 ) / TILE_SIZE;
+    for ( int r = r0; r <= r1; r++ ) {
+      for ( int c = c0; c <= c1; c++ ) {
+        bool *t = covered + (size_t) r * cols + c;
+        if ( *t )
+          continue;
+        keep[ i ] = true;
+        
+        Rect tile;
+        tile.x0 = c * TILE_SIZE;
+        tile.y0 = r * TILE_SIZE;
+        tile.x1 = width - tile.x0 > TILE_SIZE ? tile.x0 + TILE_SIZE : width;
+        tile.y1 = height - tile.y0 > TILE_SIZE ? tile.y0 + TILE_SIZE : height;
+        *t = commandCovers( cmd, &tile );
+      }
+    }
+    if ( !keep[ i ] )
+      culled++;
+  }
+  
+  //Moves the commands that are left down, keeping them in order
+  int n = 0;
+  for ( int i = 0; i < script->count; i++ )
+    if ( keep[ i ] )
+      script->cmds[ n++ ] = script->cmds[ i ];
+  script->count = n;
+  
+  free( keep );
+  free( covered );
+  return culled;
+}
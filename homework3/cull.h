@@ -0,0 +1,41 @@
+/**
+  @file cull.h
+  @author Jesse Liddle (jaliddl2)
+
+  An optional pass over a script that throws away commands whose pixels
+  would all be painted over by later commands anyway.
+*/
+#ifndef _CULL_H_
+#define _CULL_H_
+
+#include "canvas.h"
+#include "script.h"
+
+/**
+  This function removes the commands of a script that can't change the
+  final picture.  The script is walked from the last command back to the
+  first while keeping track of which tiles are completely painted by
+  later commands.  A command is dropped when every tile it could touch
+  is already painted, or when it can't touch the canvas at all.  Only
+  circles and rectangles that fill a whole tile count as painting it,
+  so the tracking never claims more than is really covered and the
+  picture drawn from what's left is exactly the same.
+  
+  @param width The width of the canvas the script will be drawn on.
+  @param height The height of the canvas the script will be drawn on.
+  @param script The script, which is changed in place.
+  @return The number of commands removed, which is 0 if there wasn't
+  enough memory to track the tiles.
+*/
+int cullScript( int width, int height, Script *script );
+
+/**
+  This function tells if a command paints every pixel of a rectangle.
+  
+  @param cmd The command.
+  @param r The rectangle.
+  @return True if every pixel of the rectangle gets painted.
+*/
+bool commandCovers( const Command *cmd, const Rect *r );
+
+#endif
@@ -0,0 +1,514 @@
+/**
+  @file drawbench.c
+  @author Jesse Liddle (jaliddl2)
+
+  Benchmark for the drawing code.  It generates synthetic scripts with a
+  chosen number of commands, mix of lines, circles, rectangles and
+  polygons, size distribution, fraction of shapes off the canvas and
+  amount of overdraw, then times parsing the script, drawing it and
+  saving the picture in every output format, each on its own.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "image.h"
+#include "script.h"
+#include "render.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+//Number of times each phase runs; the fastest run is reported
+#define RUNS 3
+
+//Kinds of commands the generator can make, in the order of the mix
+#define KINDS 4
+
+//Most corners a generated polygon has
+#define MAX_CORNERS 8
+
+//Not every math.h defines M_PI in strict C99
+#define PI 3.14159265358979323846
+
+//Bytes in a megabyte, for the throughput report
+#define MEGABYTE ( 1024.0 * 1024.0 )
+
+//Parameters for one generated script
+typedef struct {
+  //Size of the canvas
+  int width;
+  int height;
+
+  //Number of commands, unless overdraw is set
+  int count;
+
+  //Relative weights of lines, circles, rectangles and polygons
+  double mix[ KINDS ];
+
+  //Mean size of a shape: the length of a line, the diameter of a circle
+  //or polygon, or the side of a rectangle
+  int meanSize;
+
+  //Size distribution: 'f'ixed, 'u'niform or 'e'xponential
+  char dist;
+
+  //Fraction of shapes centered off the canvas
+  double offCanvas;
+
+  //If more than zero, commands are made until they would cover the
+  //canvas this many times over, instead of making count of them
+  double overdraw;
+
+  unsigned long long seed;
+} Params;
+
+//A script's text, built up in memory
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t cap;
+} Text;
+
+//State of the random number generator
+static unsigned long long rngState;
+
+/**
+  This function returns the next value from a xorshift64* generator.
+
+  @return A random 64-bit value.
+*/
+static unsigned long long nextRandom()
+{
+  rngState ^= rngState >> 12;
+  rngState ^= rngState << 25;
+  rngState ^= rngState >> 27;
+  return rngState * 0x2545f4914f6cdd1dull;
+}
+
+/**
+  This function returns a random double in [0, 1).
+
+  @return The random value.
+*/
+static double randomUnit()
+{
+  return ( nextRandom() >> 11 ) * ( 1.0 / 9007199254740992.0 );
+}
+
+/**
+  This function returns a random integer in [lo, hi].
+
+  @param lo The smallest value.
+  @param hi The largest value, at least lo.
+  @return The random value.
+*/
+static int randomRange( int lo, int hi )
+{
+  return lo + (int) ( nextRandom() % ( (unsigned long long) hi - lo + 1 ) );
+}
+
+/**
+  This function picks the size of the next shape.
+
+  @param p The script parameters.
+  @return The size, at least one.
+*/
+static int shapeSize( const Params *p )
+{
+  double size;
+  if ( p->dist == 'u' )
+    size = 1 + randomUnit() * ( 2 * p->meanSize - 1 );
+  else if ( p->dist == 'e' )
+    size = -p->meanSize * log1p( -randomUnit() );
+  else
+    size = p->meanSize;
+  return size < 1 ? 1 : size > 1e8 ? 100000000 : (int) size;
+}
+
+/**
+  This function adds formatted text to the end of a script.
+
+  @param t The script text.
+  @param fmt The printf format.
+*/
+static void addText( Text *t, const char *fmt, ... )
+{
+  va_list ap;
+  while ( true ) {
+    va_start( ap, fmt );
+    int n = vsnprintf( t->buf + t->len, t->cap - t->len, fmt, ap );
+    va_end( ap );
+    if ( t->len + n < t->cap ) {
+      t->len += n;
+      return;
+    }
+    t->cap = t->cap ? t->cap * 2 : 1 << 16;
+    t->buf = (char *) realloc( t->buf, t->cap );
+  }
+}
+
+/**
+  This function picks the center of the next shape.  Most are somewhere
+  on the canvas, but offCanvas of them are in a border around it as wide
+  as the shape, so some of those still reach onto the canvas and some
+  don't.
+
+  @param p The script parameters.
+  @param size The size of the shape.
+  @param x Filled in with the x value of the center.
+  @param y Filled in with the y value of the center.
+*/
+static void shapeCenter( const Params *p, int size, int *x, int *y )
+{
+  if ( randomUnit() >= p->offCanvas ) {
+    *x = randomRange( 0, p->width - 1 );
+    *y = randomRange( 0, p->height - 1 );
+    return;
+  }
+
+  //Picks a side, then a place along it and a distance out from it
+  int out = randomRange( 1, size );
+  switch ( nextRandom() % 4 ) {
+  case 0:
+    *x = -out;
+    *y = randomRange( -size, p->height - 1 + size );
+    break;
+  case 1:
+    *x = p->width - 1 + out;
+    *y = randomRange( -size, p->height - 1 + size );
+    break;
+  case 2:
+    *x = randomRange( -size, p->width - 1 + size );
+    *y = -out;
+    break;
+  default:
+    *x = randomRange( -size, p->width - 1 + size );
+    *y = p->height - 1 + out;
+    break;
+  }
+}
+
+/**
+  This function finds how much of a box is on the canvas.
+
+  @param p The script parameters.
+  @param x0 The left side of the box.
+  @param y0 The top of the box.
+  @param x1 The right side of the box.
+  @param y1 The bottom of the box.
+  @return The area of the part on the canvas.
+*/
+static double visibleArea( const Params *p, double x0, double y0, double x1, double y1 )
+{
+  x0 = x0 < 0 ? 0 : x0;
+  y0 = y0 < 0 ? 0 : y0;
+  x1 = x1 > p->width ? p->width : x1;
+  y1 = y1 > p->height ? p->height : y1;
+  return x1 > x0 && y1 > y0 ? ( x1 - x0 ) * ( y1 - y0 ) : 0;
+}
+
+/**
+  This function generates a script.  Every command also adds a rough
+  guess at the pixels it paints to the total, which is what overdraw is
+  measured against.
+
+  @param p The script parameters.
+  @param t Filled in with the script text.
+  @param painted Filled in with the guess at the pixels painted.
+  @return The number of commands.
+*/
+static int generate( const Params *p, Text *t, double *painted )
+{
+  rngState = p->seed ? p->seed : 1;
+  t->len = 0;
+  *painted = 0;
+
+  double total = 0;
+  for ( int k = 0; k < KINDS; k++ )
+    total += p->mix[ k ];
+  double goal = p->overdraw * p->width * p->height;
+
+  int n = 0;
+  while ( p->overdraw > 0 ? *painted < goal : n < p->count ) {
+    double pick = randomUnit() * total;
+    int kind = 0;
+    while ( kind < KINDS - 1 && pick >= p->mix[ kind ] ) {
+      pick -= p->mix[ kind ];
+      kind++;
+    }
+
+    int size = shapeSize( p );
+    int cx, cy;
+    shapeCenter( p, size, &cx, &cy );
+    int color = randomRange( 0, 255 );
+    double half = size / 2.0;
+    double area = visibleArea( p, cx - half, cy - half, cx + half, cy + half );
+
+    if ( kind == 0 ) {
+      double angle = randomUnit() * 2 * PI;
+      int dx = lround( cos( angle ) * half );
+      int dy = lround( sin( angle ) * half );
+      addText( t, "l %d %d %d %d %d\n", cx - dx, cy - dy, cx + dx, cy + dy, color );
+      *painted += area > 0 ? size : 0;
+    } else if ( kind == 1 ) {
+      int radius = size / 2 > 0 ? size / 2 : 1;
+      addText( t, "c %d %d %d %d\n", cx, cy, radius, color );
+      *painted += area * PI / 4;
+    } else if ( kind == 2 ) {
+      int w = randomRange( 1, 2 * size );
+      int h = randomRange( 1, 2 * size );
+      addText( t, "r %d %d %d %d %d\n", cx - w / 2, cy - h / 2,
+               cx - w / 2 + w, cy - h / 2 + h, color );
+      *painted += visibleArea( p, cx - w / 2, cy - h / 2, cx - w / 2 + w,
+                               cy - h / 2 + h );
+    } else {
+      //Corners at increasing angles around the center, so the polygon
+      //doesn't cross itself
+      int corners = randomRange( 3, MAX_CORNERS );
+      addText( t, "p %d", corners );
+      for ( int i = 0; i < corners; i++ ) {
+        double angle = 2 * PI * ( i + randomUnit() ) / corners;
+        double r = half * ( 0.5 + 0.5 * randomUnit() );
+        addText( t, " %ld %ld", cx + lround( cos( angle ) * r ),
+                 cy + lround( sin( angle ) * r ) );
+      }
+      addText( t, " %d\n", color );
+      *painted += area / 2;
+    }
+    n++;
+  }
+  return n;
+}
+
+/**
+  This function returns the current value of the monotonic clock in
+  seconds.
+
+  @return The time in seconds.
+*/
+static double now()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+  This function generates one script and times every phase of drawing it.
+
+  @param p The script parameters.
+  @param threads Number of threads to draw with.
+  @param scriptPath File to save the generated script to, or NULL.
+  @param imagePath Scratch file for the saved pictures.
+  @return False if something couldn't be done.
+*/
+static bool benchmark( const Params *p, int threads, const char *scriptPath,
+                       const char *imagePath )
+{
+  static const char *mixNames = "lcrp";
+  Text text = { NULL, 0, 0 };
+  double painted;
+  int count = generate( p, &text, &painted );
+
+  printf( "%dx%d, %d commands, mix", p->width, p->height, count );
+  for ( int k = 0; k < KINDS; k++ )
+    printf( " %c%g", mixNames[ k ], p->mix[ k ] );
+  printf( ", size %d%c, %.2f off canvas, overdraw %.2f, %d thread%s\n", p->meanSize,
+          p->dist, p->offCanvas, painted / ( (double) p->width * p->height ),
+          threads, threads == 1 ? "" : "s" );
+
+  if ( scriptPath ) {
+    FILE *fp = fopen( scriptPath, "w" );
+    if ( !fp || fwrite( text.buf, 1, text.len, fp ) != text.len || fclose( fp ) != 0 ) {
+      fprintf( stderr, "Can't write file: %s\n", scriptPath );
+      free( text.buf );
+      return false;
+    }
+  }
+
+  //Parsing
+  Script script = { NULL, 0, 0, NULL, 0, 0 };
+  double best = 0;
+  for ( int r = 0; r < RUNS; r++ ) {
+    freeScript( &script );
+    double t = now();
+    bool valid = parseScript( text.buf, text.len, &script );
+    t = now() - t;
+    if ( !valid ) {
+      fprintf( stderr, "Generated an invalid script\n" );
+      freeScript( &script );
+      free( text.buf );
+      return false;
+    }
+    if ( r == 0 || t < best )
+      best = t;
+  }
+  printf( "  %-8s %9.3f ms %10.2f Mcmd/s %10.2f MB/s\n", "parse", best * 1e3,
+          count / best / 1e6, text.len / MEGABYTE / best );
+  free( text.buf );
+
+  //Drawing, on a canvas cleared before each run
+  Canvas *image = makeCanvas( p->width, p->height );
+  if ( !image ) {
+    fprintf( stderr, "Not enough memory for the canvas\n" );
+    freeScript( &script );
+    return false;
+  }
+  //The pixels the script really writes are counted in an untimed pass
+  //first, since the generator's guess is only good enough to aim for
+  //an overdraw
+  Rect all = { 0, 0, p->width, p->height };
+  long long written = 0;
+  for ( int i = 0; i < script.count; i++ )
+    written += drawCommand( image, &all, &script, script.cmds + i, NULL );
+  for ( int r = 0; r < RUNS; r++ ) {
+    clearImage( image, 255 );
+    double t = now();
+    renderScript( image, &script, threads );
+    t = now() - t;
+    if ( r == 0 || t < best )
+      best = t;
+  }
+  printf( "  %-8s %9.3f ms %10.2f Mcmd/s %10.2f Mpx/s\n", "raster", best * 1e3,
+          count / best / 1e6, written / best / 1e6 );
+  freeScript( &script );
+
+  //Saving in every format, timed up to the file being closed
+  static const struct {
+    const char *name;
+    ImageFormat format;
+  } formats[] = {
+    { "p2", FORMAT_P2 }, { "p5", FORMAT_P5 }, { "rle", FORMAT_RLE }, { "png", FORMAT_PNG },
+    { "p6", FORMAT_P6 }
+  };
+  double pixels = (double) p->width * p->height;
+  bool ok = true;
+  for ( int f = 0; f < sizeof( formats ) / sizeof( formats[ 0 ] ); f++ ) {
+    struct stat st;
+    for ( int r = 0; r < RUNS; r++ ) {
+      double t = now();
+      FILE *fp = fopen( imagePath, "wb" );
+      if ( fp ) {
+        saveImage( image, fp, formats[ f ].format );
+        ok = fclose( fp ) == 0 && ok;
+      } else {
+        ok = false;
+      }
+      t = now() - t;
+      if ( r == 0 || t < best )
+        best = t;
+    }
+    if ( !ok || stat( imagePath, &st ) != 0 ) {
+      fprintf( stderr, "Can't write file: %s\n", imagePath );
+      ok = false;
+      break;
+    }
+    printf( "  save %-3s %9.3f ms %10.2f Mpx/s  %10.2f MB/s %12lld bytes\n",
+            formats[ f ].name, best * 1e3, pixels / best / 1e6,
+            st.st_size / MEGABYTE / best, (long long) st.st_size );
+  }
+
+  freeCanvas( image );
+  remove( imagePath );
+  return ok;
+}
+
+/**
+  This function reads a mix of command kinds, given as up to four
+  comma-separated weights for lines, circles, rectangles and polygons.
+
+  @param s The text to read.
+  @param mix Filled in with the weights; missing ones are zero.
+  @return False if the mix isn't valid.
+*/
+static bool parseMix( const char *s, double mix[] )
+{
+  double total = 0;
+  for ( int k = 0; k < KINDS; k++ ) {
+    char *end = NULL;
+    mix[ k ] = *s ? strtod( s, &end ) : 0;
+    if ( *s && ( end == s || mix[ k ] < 0 ) )
+      return false;
+    if ( !*s )
+      continue;
+    total += mix[ k ];
+    s = *end == ',' ? end + 1 : end;
+  }
+  return *s == '\0' && total > 0;
+}
+
+/**
+  This is the starting point for the benchmark.  With no options it runs
+  a standard sweep of command kinds and script shapes; any option but -j
+  picks a single script instead.
+*/
+int main( int argc, char *argv[] )
+{
+  Params p = { 2000, 2000, 100000, { 4, 3, 2, 1 }, 40, 'e', 0.1, 0, 12345 };
+  int threads = 1;
+  const char *scriptPath = NULL;
+  const char *imagePath = "bench_output.pgm";
+  bool single = false;
+  bool valid = true;
+  int opt;
+
+  while ( ( opt = getopt( argc, argv, "s:n:m:l:D:x:v:r:j:o:" ) ) != -1 ) {
+    single = single || opt != 'j';
+    switch ( opt ) {
+    case 's':
+      valid = sscanf( optarg, "%dx%d", &p.width, &p.height ) == 2 && valid;
+      break;
+    case 'n': p.count = atoi( optarg ); break;
+    case 'm': valid = parseMix( optarg, p.mix ) && valid; break;
+    case 'l': p.meanSize = atoi( optarg ); break;
+    case 'D': p.dist = optarg[ 0 ]; break;
+    case 'x': p.offCanvas = atof( optarg ); break;
+    case 'v': p.overdraw = atof( optarg ); break;
+    case 'r': p.seed = strtoull( optarg, NULL, 10 ); break;
+    case 'j': threads = atoi( optarg ); break;
+    case 'o': scriptPath = optarg; break;
+    default: valid = false; break;
+    }
+  }
+
+  if ( !valid || p.width < 1 || p.height < 1 || p.count < 0 || p.meanSize < 1
+       || ( p.dist != 'f' && p.dist != 'u' && p.dist != 'e' )
+       || p.offCanvas < 0 || p.offCanvas > 1 || p.overdraw < 0 || threads < 1
+       || optind != argc ) {
+    fprintf( stderr, "usage: drawbench [-s WIDTHxHEIGHT] [-n commands] "
+             "[-m lines,circles,rects,polygons] [-l mean_size] [-D f|u|e] "
+             "[-x off_canvas_fraction] [-v overdraw] [-r seed] [-j threads] "
+             "[-o script_file]\n" );
+    return EXIT_FAILURE;
+  }
+
+  bool ok = true;
+  if ( single ) {
+    ok = benchmark( &p, threads, scriptPath, imagePath );
+  } else {
+    //The standard sweep: each kind of command on its own, then mixes of
+    //small and big shapes, lots of shapes off the canvas and heavy
+    //overdraw
+    static const Params sweep[] = {
+      { 2000, 2000, 200000, { 1, 0, 0, 0 }, 40, 'e', 0.1, 0, 1 },
+      { 2000, 2000, 200000, { 0, 1, 0, 0 }, 40, 'e', 0.1, 0, 2 },
+      { 2000, 2000, 200000, { 0, 0, 1, 0 }, 40, 'e', 0.1, 0, 3 },
+      { 2000, 2000, 200000, { 0, 0, 0, 1 }, 40, 'e', 0.1, 0, 4 },
+      { 2000, 2000, 1000000, { 4, 3, 2, 1 }, 4, 'u', 0.1, 0, 5 },
+      { 2000, 2000, 2000, { 4, 3, 2, 1 }, 1000, 'u', 0.1, 0, 6 },
+      { 2000, 2000, 200000, { 4, 3, 2, 1 }, 40, 'e', 0.9, 0, 7 },
+      { 2000, 2000, 0, { 0, 1, 1, 1 }, 200, 'e', 0.1, 50, 8 },
+    };
+    for ( int i = 0; i < sizeof( sweep ) / sizeof( sweep[ 0 ] ); i++ ) {
+      ok = benchmark( &sweep[ i ], threads, NULL, imagePath ) && ok;
+      printf( "\n" );
+    }
+  }
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
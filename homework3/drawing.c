@@ -7,79 +7,384 @@
   and is called first.
 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "image.h"
+#include "script.h"
+#include "render.h"
+#include "cull.h"
+#include "load.h"
+#include "batch.h"
+#include "stats.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <math.h>
 
 /**
-  This is the main function of the program and is
-  called to run as soon as the program is executed.
+  Prints the usage message for the program.
+*/
+static void usage()
+{
+  fprintf(stderr, "usage: drawing [options] <script_file> <image_file>\n"
+                  "       drawing [options] -b <manifest>\n"
+                  "options: -f p2|p5|rle|png|p6 -s WIDTHxHEIGHT -j THREADS -O -t\n"
+                  "         -i IMAGE -u -S -c FILE -C\n");
+}
+
+/**
+  Draws a script one command at a time, then reports what each
+  command cost.
+  
+  @param picture The canvas to draw on.
+  @param script The commands to draw.
+  @param summary Whether to print a summary to standard error.
+  @param csvFile File to write statistics on every command to, or NULL.
+  @return False if the statistics couldn't be kept or written.
+*/
+static bool drawWithStats( Canvas *picture, const Script *script,
+                           bool summary, const char *csvFile )
+{
+  CommandStats *stats = renderStats( picture, script );
+  if ( stats == NULL ) {
+    fprintf(stderr, "Can't make a %dx%d image\n", picture->width, picture->height);
+    return false;
+  }
+  
+  if ( summary )
+    printStats( stderr, picture, stats, script->count );
+  
+  bool ok = true;
+  if ( csvFile ) {
+    FILE *csvF = fopen( csvFile, "w" );
+    ok = csvF && writeStatsCsv( csvF, stats, script->count );
+    ok = csvF && fclose( csvF ) == 0 && ok;
+    if ( !ok )
+      fprintf(stderr, "Can't write file: %s\n", csvFile);
+  }
+  free( stats );
+  return ok;
+}
+
+/**
+  Compiles a script into a binary file.
+  
+  @param scriptFile The script to compile.
+  @param outputFile The file to write the compiled script to.
+  @param cull Whether to drop hidden commands first.
+  @param width The width of the picture, for culling.
+  @param height The height of the picture, for culling.
+  @return The exit status for the program.
+*/
+static int compileScript( const char *scriptFile, const char *outputFile,
+                          bool cull, int width, int height )
+{
+  FILE *inputF = fopen( scriptFile, "r" );
+  if ( inputF == NULL ) {
+    fprintf(stderr, "Can't open file: %s\n", scriptFile);
+    usage();
+    return -1;
+  }
+  
+  Script script;
+  if ( !readScript( inputF, &script ) ) {
+    fprintf(stderr, "Invalid script file\n");
+    return -1;
+  }
+  fclose(inputF);
+  
+  if ( cull ) {
+    int total = script.count;
+    int culled = cullScript( width, height, &script );
+    fprintf(stderr, "Culled %d of %d commands\n", culled, total);
+  }
+  
+  FILE *outputF = fopen( outputFile, "wb" );
+  if ( outputF == NULL ) {
+    fprintf(stderr, "Can't open file: %s\n", outputFile);
+    usage();
+    return -1;
+  }
+  bool ok = writeCompiled( outputF, &script );
+  ok = fclose(outputF) == 0 && ok;
+  freeScript( &script );
+  if ( !ok ) {
+    fprintf(stderr, "Can't write file: %s\n", outputFile);
+    return -1;
+  }
+  return EXIT_SUCCESS;
+}
+
+/**
+  This is the main function of the program and is called to run as
+  soon as the program is executed.  It draws a script to an image file,
+  or with -b, every job in a manifest.  The options are:
+  
+  -f p2|p5|rle|png|p6  Output format: plain P2 (the default), raw P5,
+                       run-length encoded rle, png, or color p6, which
+                       draws RGB colors in color instead of as grey.
+  -s WIDTHxHEIGHT      Size of the picture.
+  -j THREADS           Number of threads to draw with.
+  -O                   Drop commands that later ones paint over, and
+                       report how many were dropped.
+  -t                   Draw on a sparse tiled canvas, for huge pictures.
+  -i IMAGE             Start from an existing PGM image instead of a
+                       white canvas.
+  -u                   Draw on the output image itself if it exists.
+                       When it's already in the chosen format, only the
+                       rows the script changes are written back.
+  -b MANIFEST          Draw every script and image pair in the manifest,
+                       -j at a time, with the -s, -f and -O options.  No
+                       file names are given with it.
+  -S                   Draw one command at a time and print what each
+                       kind of command cost and the slowest commands.
+  -c FILE              Write the same statistics for every command to a
+                       CSV file.
+  -C                   Compile the script into a binary file, named
+                       where the image would be, instead of drawing it.
+                       With -O it is culled for the -s size first.
+  
+  Compiled scripts can be given anywhere a script can, and aren't parsed.
 */
 int main( int argc, char **argv )
 {
-  char type;//Type of object being drawn
-  int match = 0;//Matches for the fscanf
-  int x1;//x1 for line or cx for circle
-  int y1;//y1 for line or cy for circle
-  int x2;//x2 for line not used for circle
-  int y2;//y2 for line not used for circle
-  int rad;//radius for circle not used for line
-  int color;//color for both circle and line
-  int maxColor = 255;
-  unsigned char picture[ WIDTH ][ HEIGHT ];//The picture this is being drawn to
+  int width = DEFAULT_WIDTH;//Size of the picture
+  int height = DEFAULT_HEIGHT;
+  int threads = 1;//Threads to draw with
+  bool cull = false;//Whether to drop hidden commands first
+  bool tiled = false;//Whether to use a tiled canvas
+  const char *startImage = NULL;//Image to draw on, if not a blank one
+  bool update = false;//Whether to draw on the output image itself
+  const char *manifest = NULL;//List of jobs, in batch mode
+  bool inPlace = false;//Whether only changed rows need to be written
+  bool summary = false;//Whether to print drawing statistics
+  const char *csvFile = NULL;//File for statistics on every command
+  bool compile = false;//Whether to write a compiled script instead
   unsigned char clearColor = 255;
-  int matchLine = 5;
-  int matchCircle = 4;
+  ImageFormat format = FORMAT_P2;
   
-  //Sets all pixels to white before drawing on them
-  clearImage( picture, clearColor );
+  //Reads the options before the file names
+  int opt;
+  char extra;
+  while ( ( opt = getopt( argc, argv, "f:s:j:Oti:ub:Sc:C" ) ) != -1 ) {
+    if ( opt == 'f' && strcmp( optarg, "p2" ) == 0 ) {
+      format = FORMAT_P2;
+    } else if ( opt == 'f' && strcmp( optarg, "p5" ) == 0 ) {
+      format = FORMAT_P5;
+    } else if ( opt == 'f' && strcmp( optarg, "rle" ) == 0 ) {
+      format = FORMAT_RLE;
+    } else if ( opt == 'f' && strcmp( optarg, "png" ) == 0 ) {
+      format = FORMAT_PNG;
+    } else if ( opt == 'f' && strcmp( optarg, "p6" ) == 0 ) {
+      format = FORMAT_P6;
+    } else if ( opt == 's' && sscanf( optarg, "%dx%d%c", &width, &height, &extra ) == 2
+                && width > 0 && height > 0 ) {
+      continue;
+    } else if ( opt == 'j' && sscanf( optarg, "%d%c", &threads, &extra ) == 1
+                && threads > 0 ) {
+      continue;
+    } else if ( opt == 'O' ) {
+      cull = true;
+    } else if ( opt == 't' ) {
+      tiled = true;
+    } else if ( opt == 'i' ) {
+      startImage = optarg;
+    } else if ( opt == 'u' ) {
+      update = true;
+    } else if ( opt == 'b' ) {
+      manifest = optarg;
+    } else if ( opt == 'S' ) {
+      summary = true;
+    } else if ( opt == 'c' ) {
+      csvFile = optarg;
+    } else if ( opt == 'C' ) {
+      compile = true;
+    } else {
+      usage();
+      return -1;
+    }
+  }
   
-  //Opens up input and output files
-  FILE *inputF = fopen( argv[1], "r" );//Opens a file for reading
-  FILE *outputF = fopen( argv[2], "w" );//Opens a file for writing
+  //Statistics are only kept for a single script on a plain canvas
+  bool stats = summary || csvFile;
+  if ( stats && ( manifest || tiled ) ) {
+    usage();
+    return -1;
+  }
   
-  if ( argc != 3 ) {
-    fprintf(stderr, "usage: drawing <script_file> <image_file>\n");
+  //Images are only loaded from PGM files, so one written in another
+  //format couldn't be drawn on again
+  if ( update && ( format == FORMAT_RLE || format == FORMAT_PNG ) ) {
+    fprintf(stderr, "Only p2 and p5 images can be updated\n");
+    usage();
     return -1;
-  } else if ( inputF == NULL ) {
-    fprintf(stderr, "Can't open file: %s\n", argv[1]);
-    fprintf(stderr, "usage: drawing <script_file> <image_file>\n");
+  }
+  
+  //Color is only drawn for a single script on a canvas of its own
+  bool color = format == FORMAT_P6 && !compile;
+  if ( color && ( manifest || tiled || update || stats ) ) {
+    usage();
     return -1;
-  } else {
-  //Loop for reading the file
-  while ( fscanf( inputF, " %c", &type ) == 1 ){
-    if ( type == 'l' || type == 'L' ){
-      match = fscanf( inputF, " %d %d %d %d %d", &x1, &y1, &x2, &y2, &color );
-      
-      //Checks to see matchs the output of the fscanf
-      if ( match == matchLine  && color >= 0 && color <= maxColor )
-        drawLine( picture, x1, y1, x2, y2, color );
-      else
-        goto ERROR;
-    } else if ( type == 'c' || type == 'C' ) {
-      match = fscanf( inputF, " %d %d %d %d", &x1, &y1, &rad, &color );
-      
-      //Checks to see matchs the output of the fscanf
-      if ( match == matchCircle  && color >= 0 && color <= maxColor )
-        drawCircle( picture, x1, y1, rad, color );
-      else
-        goto ERROR;
-    } else {
-ERROR:
-      //Error if line does not start with l or c
-      fprintf(stderr, "Invalid script file\n");
+  }
+  
+  if ( manifest ) {
+    if ( argc - optind != 0 ) {
+      usage();
       return -1;
-      break;
-    }//End of if-else statement
+    }
+    
+    FILE *manifestF = fopen( manifest, "r" );
+    if ( manifestF == NULL ) {
+      fprintf(stderr, "Can't open file: %s\n", manifest);
+      usage();
+      return -1;
+    }
+    BatchOptions opts = { width, height, format, cull, threads };
+    int failed = runBatch( manifestF, &opts );
+    fclose(manifestF);
+    if ( failed == BATCH_INVALID )
+      fprintf(stderr, "Invalid manifest file: %s\n", manifest);
+    else if ( failed == BATCH_NO_MEMORY )
+      fprintf(stderr, "Not enough memory for manifest file: %s\n", manifest);
+    return failed == 0 ? EXIT_SUCCESS : -1;
+  }
+  
+  if ( argc - optind != 2 ) {
+    usage();
+    return -1;
+  }
+  
+  if ( compile )
+    return compileScript( argv[optind], argv[optind + 1], cull, width, height );
+  
+  //The picture this is being drawn to, starting out all white or as
+  //a copy of the starting image, which sets its size
+  Canvas *picture = NULL;
+  TiledCanvas *tiledPicture = NULL;
+  RgbCanvas *rgbPicture = NULL;
+  FILE *outputF = NULL;
+  if ( update && ( outputF = fopen( argv[optind + 1], "r+" ) ) != NULL ) {
+    ImageFormat oldFormat;
+    bool exact;
+    if ( tiled )
+      tiledPicture = loadTiledImage( outputF );
+    else
+      picture = loadImage( outputF, &oldFormat, &exact );
     
-    //match = fscanf( inputF, "\n%c", &type );
+    if ( picture == NULL && tiledPicture == NULL ) {
+      fprintf(stderr, "Invalid image file: %s\n", argv[optind + 1]);
+      return -1;
+    }
+    width = picture ? picture->width : tiledPicture->width;
+    height = picture ? picture->height : tiledPicture->height;
+    inPlace = picture && exact && oldFormat == format && trackChanges( picture );
+  } else if ( startImage ) {
+    FILE *imageF = fopen( startImage, "r" );
+    if ( imageF == NULL ) {
+      fprintf(stderr, "Can't open file: %s\n", startImage);
+      usage();
+      return -1;
+    }
+    if ( tiled )
+      tiledPicture = loadTiledImage( imageF );
+    else
+      picture = loadImage( imageF, NULL, NULL );
+    fclose(imageF);
     
-  }//End of while loop
-
-    saveImage( picture, outputF );//Saves file
-    fclose(inputF);//Closes the inputF file
-    fclose(outputF);//Closes the outputF file
-    return EXIT_SUCCESS;
+    if ( picture == NULL && tiledPicture == NULL ) {
+      fprintf(stderr, "Invalid image file: %s\n", startImage);
+      return -1;
+    }
+    width = picture ? picture->width : tiledPicture->width;
+    height = picture ? picture->height : tiledPicture->height;
+    if ( picture && color ) {
+      rgbPicture = copyToRgb( picture );
+      freeCanvas( picture );
+      picture = NULL;
+    }
+  } else if ( tiled ) {
+    tiledPicture = makeTiledCanvas( width, height, clearColor );
+  } else if ( color ) {
+    if ( ( rgbPicture = makeRgbCanvas( width, height ) ) != NULL )
+      for ( int p = 0; p < RGB_PLANES; p++ )
+        clearImage( rgbPicture->planes[ p ], clearColor );
+  } else if ( ( picture = makeCanvas( width, height ) ) != NULL ) {
+    clearImage( picture, clearColor );
+  }
+  
+  if ( picture == NULL && tiledPicture == NULL && rgbPicture == NULL ) {
+    fprintf(stderr, "Can't make a %dx%d image\n", width, height);
+    return -1;
+  }
+  
+  //Opens up input and output files
+  FILE *inputF = fopen( argv[optind], "r" );//Opens a file for reading
+  
+  if ( inputF == NULL ) {
+    fprintf(stderr, "Can't open file: %s\n", argv[optind]);
+    usage();
+    return -1;
+  }
+  
+  if ( outputF == NULL )
+    outputF = fopen( argv[optind + 1], "w" );//Opens a file for writing
+  
+  if ( outputF == NULL ) {
+    fprintf(stderr, "Can't open file: %s\n", argv[optind + 1]);
+    usage();
+    return -1;
+  }
+  
+  //Reads the whole script before drawing any of it
+  Script script;
+  if ( !readScript( inputF, &script ) ) {
+    fprintf(stderr, "Invalid script file\n");
+    return -1;
+  }
+  
+  if ( cull ) {
+    int total = script.count;
+    int culled = cullScript( width, height, &script );
+    fprintf(stderr, "Culled %d of %d commands\n", culled, total);
+  }
+  
+  //An image being updated that can't be patched is written from scratch
+  if ( update && !inPlace ) {
+    rewind( outputF );
+    if ( ftruncate( fileno( outputF ), 0 ) != 0 ) {
+      fprintf(stderr, "Can't write file: %s\n", argv[optind + 1]);
+      return -1;
+    }
+  }
+  
+  if ( tiledPicture ) {
+    if ( !renderTiled( tiledPicture, &script, threads ) ) {
+      fprintf(stderr, "Can't make a %dx%d image\n", width, height);
+      return -1;
+    }
+    saveTiledImage( tiledPicture, outputF, format );//Saves file
+    freeTiledCanvas( tiledPicture );
+  } else if ( rgbPicture ) {
+    renderRgb( rgbPicture, &script, threads );
+    saveRgbImage( rgbPicture, outputF );//Saves file
+    freeRgbCanvas( rgbPicture );
+  } else {
+    if ( !stats ) {
+      renderScript( picture, &script, threads );
+    } else if ( !drawWithStats( picture, &script, summary, csvFile ) ) {
+      return -1;
+    }
+    if ( !inPlace ) {
+      saveImage( picture, outputF, format );//Saves file
+    } else if ( !updateImage( picture, fileno( outputF ), format ) ) {
+      fprintf(stderr, "Can't write file: %s\n", argv[optind + 1]);
+      return -1;
+    }
+    freeCanvas( picture );
   }
+  fclose(inputF);//Closes the inputF file
+  fclose(outputF);//Closes the outputF file
+  freeScript( &script );
+  return EXIT_SUCCESS;
 }
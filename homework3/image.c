@@ -5,13 +5,45 @@
   This part of the drawing program provides some of
   the main functionality for the drawing.c file.
 */
+#define _POSIX_C_SOURCE 200809L
+
 #include "image.h"
+#include "png.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
 #include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
 
 #define COORDS 2
 
+//Largest pixel value
+#define MAX_COLOR 255
+
+//Characters written for each pixel in a P2 file
+#define PIXEL_TEXT 4
+
+//Size of the buffer P2 text is formatted into before it's written
+#define TEXT_BUFFER ( 1 << 20 )
+
+//Most bytes one run-length code covers
+#define RLE_MAX 128
+
+//Most bytes a row of the given width can take run-length encoded
+#define RLE_ROOM( width ) ( (size_t) ( width ) + ( width ) / RLE_MAX + 1 )
+
+//Bytes the vector interleave can write past the end of a P6 row
+#define RGB_SLACK 4
+
+//Room for the longest PGM header this writes
+#define HEADER_SIZE 64
+
 /**
   This function is used to clear the image.  It sets all the pixels to one
   specific color that is passed to this function.
@@ -19,13 +51,356 @@
   @param image The image that is being edited.
   @param color The color that is being put on all pixels.
 */
-void clearImage( unsigned char image [ WIDTH ] [ HEIGHT ], unsigned char color )
+void clearImage( Canvas *image, unsigned char color )
+{
+  clearCanvas( image, color );
+  markRows( image, 0, image->height );
+}
+
+//Where the rows of an image that is being saved come from
+typedef struct {
+  //Size of the image
+  int width;
+  int height;
+  
+  //The image, which is either a plain canvas or a tiled one
+  const Canvas *canvas;
+  const TiledCanvas *tiled;
+  
+  //A row put together from tiles, and whether every tile in the row of
+  //tiles it came from is solid
+  unsigned char *scratch;
+  bool solidBand;
+} RowSource;
+
+/**
+  This function gets one row of an image that is being saved.  Rows of a
+  tiled canvas are copied together from the tiles, with solid tiles
+  filled in a whole tile width at a time.  When every tile across a row
+  of tiles is solid, all the pixel rows in it are the same, so only the
+  first one is built and the rest are reported as repeats.
+  
+  @param src The image.
+  @param y The row to get; rows must be asked for in order.
+  @param repeat Set to true if the row is the same as the one before.
+  @return The pixels of the row.
+*/
+static const unsigned char *sourceRow( RowSource *src, int y, bool *repeat )
+{
+  *repeat = false;
+  if ( src->tiled == NULL )
+    return canvasRow( src->canvas, y );
+  
+  const TiledCanvas *t = src->tiled;
+  unsigned char * const *tiles = t->tiles + (size_t) ( y / TILE_SIZE ) * t->cols;
+  const unsigned char *solid = t->solid + (size_t) ( y / TILE_SIZE ) * t->cols;
+  if ( y % TILE_SIZE == 0 ) {
+    src->solidBand = true;
+    for ( int c = 0; c < t->cols && src->solidBand; c++ )
+      src->solidBand = tiles[ c ] == NULL;
+  } else if ( src->solidBand ) {
+    *repeat = true;
+    return src->scratch;
+  }
+  
+  for ( int c = 0; c < t->cols; c++ ) {
+    int x = c * TILE_SIZE;
+    int n = t->width - x < TILE_SIZE ? t->width - x : TILE_SIZE;
+    if ( tiles[ c ] )
+      memcpy( src->scratch + x, tiles[ c ] + y % TILE_SIZE * TILE_SIZE, n );
+    else
+      memset( src->scratch + x, solid[ c ], n );
+  }
+  return src->scratch;
+}
+
+/**
+  Writes the image as a raw P5 file, one fwrite per row.
+  
+  @param src The image that is being saved.
+  @param outputFile The file where data is being wrote to.
+*/
+static void saveBinary( RowSource *src, FILE *outputFile )
 {
-  for ( int k = 0; k < HEIGHT; k++ ) {
-    for ( int i = 0; i < WIDTH; i++ ) {
-      image[i][k] = color;
+  bool repeat;
+  fprintf( outputFile, "P5\n%d %d\n255\n", src->width, src->height );
+  for ( int k = 0; k < src->height; k++ )
+    fwrite( sourceRow( src, k, &repeat ), 1, src->width, outputFile );
+}
+
+//Text for every pixel value, built the first time it's needed
+static char digits[ MAX_COLOR + 1 ][ PIXEL_TEXT ];
+static pthread_once_t digitsOnce = PTHREAD_ONCE_INIT;
+
+/**
+  Fills in the text for every pixel value.
+*/
+static void makeDigits( void )
+{
+  for ( int v = 0; v <= MAX_COLOR; v++ ) {
+    digits[v][0] = v >= 100 ? '0' + v / 100 : ' ';
+    digits[v][1] = v >= 10 ? '0' + v / 10 % 10 : ' ';
+    digits[v][2] = '0' + v % 10;
+    digits[v][3] = ' ';
+  }
+}
+
+/**
+  Formats one row of pixels as P2 text.  Every pixel value is written
+  right-aligned in three columns followed by a space, or by a newline at
+  the end of the row, so each pixel is exactly PIXEL_TEXT characters and
+  can be copied from a table.
+  
+  @param row The pixels of the row.
+  @param width The number of pixels in the row.
+  @param out Where to put the text, with room for width * PIXEL_TEXT
+  characters.
+*/
+static void encodeRow( const unsigned char *row, int width, char *out )
+{
+  pthread_once( &digitsOnce, makeDigits );
+  for ( int i = 0; i < width; i++ )
+    memcpy( out + (size_t) i * PIXEL_TEXT, digits[ row[i] ], PIXEL_TEXT );
+  
+  //Ends the row with a newline instead of a space
+  out[ (size_t) width * PIXEL_TEXT - 1 ] = '\n';
+}
+
+/**
+  Writes the image as a plain P2 file.  Rows are formatted into a
+  reusable buffer that is only written when it fills up, which for the
+  default canvas means one fwrite for the whole image.  A row that
+  repeats the one before it is copied from that row's text instead of
+  being formatted.
+  
+  @param src The image that is being saved.
+  @param outputFile The file where data is being wrote to.
+*/
+static void saveText( RowSource *src, FILE *outputFile )
+{
+  //The buffer always holds at least one row.  Each thread keeps its own,
+  //so threads saving different images at once can reuse theirs.
+  static __thread char *text = NULL;
+  static __thread size_t capacity = 0;
+  size_t rowText = (size_t) src->width * PIXEL_TEXT;
+  size_t needed = rowText > TEXT_BUFFER ? rowText : TEXT_BUFFER;
+  if ( capacity < needed ) {
+    free( text );
+    text = (char *) malloc( needed );
+    capacity = needed;
+  }
+  
+  fprintf( outputFile, "P2\n%d %d\n255\n", src->width, src->height );
+  
+  char *out = text;
+  char *last = NULL;//Text of the row before, if it's still in the buffer
+  for ( int k = 0; k < src->height; k++ ) {
+    if ( out + rowText > text + capacity ) {
+      fwrite( text, 1, out - text, outputFile );
+      out = text;
+      last = NULL;
     }
+    
+    bool repeat;
+    const unsigned char *row = sourceRow( src, k, &repeat );
+    if ( repeat && last )
+      memcpy( out, last, rowText );
+    else
+      encodeRow( row, src->width, out );
+    last = out;
+    out += rowText;
   }
+  
+  fwrite( text, 1, out - text, outputFile );
+}
+
+/**
+  Run-length encodes one row the PackBits way.  A control byte from 0 to
+  127 is followed by that many plus one bytes to copy, and a control
+  byte from 129 to 255 is followed by one byte to repeat 257 minus the
+  control byte times, from 2 up to 128 times.
+  
+  @param row The pixels of the row.
+  @param width The number of pixels in the row.
+  @param out Where to put the encoded row, with room for RLE_ROOM( width )
+  bytes.
+  @return The number of bytes in the encoded row.
+*/
+static size_t encodeRunRow( const unsigned char *row, int width, unsigned char *out )
+{
+  unsigned char *start = out;
+  int i = 0;
+  while ( i < width ) {
+    //Finds the run starting here
+    int run = 1;
+    while ( i + run < width && run < RLE_MAX && row[ i + run ] == row[ i ] )
+      run++;
+    if ( run >= 2 ) {
+      *out++ = 257 - run;
+      *out++ = row[ i ];
+      i += run;
+      continue;
+    }
+    
+    //Copies bytes until a run of at least three starts
+    int n = 1;
+    while ( i + n < width && n < RLE_MAX
+            && !( i + n + 2 < width && row[ i + n ] == row[ i + n + 1 ]
+                  && row[ i + n ] == row[ i + n + 2 ] ) )
+      n++;
+    *out++ = n - 1;
+    memcpy( out, row + i, n );
+    out += n;
+    i += n;
+  }
+  return out - start;
+}
+
+/**
+  Writes the image as a run-length encoded PGM.  It has the same header
+  as a P5 file except for the magic number, R5, and then each row on its
+  own, encoded by encodeRunRow().  A row that repeats the one before is
+  written from the same encoded bytes.
+  
+  @param src The image that is being saved.
+  @param outputFile The file where data is being wrote to.
+*/
+static void saveRuns( RowSource *src, FILE *outputFile )
+{
+  unsigned char *out = (unsigned char *) malloc( RLE_ROOM( src->width ) );
+  size_t len = 0;
+  fprintf( outputFile, "R5\n%d %d\n255\n", src->width, src->height );
+  for ( int k = 0; k < src->height; k++ ) {
+    bool repeat;
+    const unsigned char *row = sourceRow( src, k, &repeat );
+    if ( !repeat || k == 0 )
+      len = encodeRunRow( row, src->width, out );
+    fwrite( out, 1, len, outputFile );
+  }
+  free( out );
+}
+
+/**
+  Writes the image as a PNG, handing it over to the PNG writer a row at
+  a time.
+  
+  @param src The image that is being saved.
+  @param outputFile The file where data is being wrote to.
+*/
+static void savePng( RowSource *src, FILE *outputFile )
+{
+  PngWriter *png = startPng( outputFile, src->width, src->height );
+  if ( png == NULL )
+    return;
+  for ( int k = 0; k < src->height; k++ ) {
+    bool repeat;
+    writePngRow( png, sourceRow( src, k, &repeat ) );
+  }
+  finishPng( png );
+}
+
+/**
+  Interleaves one row of three planes into red, green, blue triples.
+  With SSE2, sixteen pixels at a time are widened to four bytes each by
+  unpacking the planes together, and then the unused fourth bytes are
+  squeezed out with shifts and masks, giving twelve bytes from each
+  vector that are written with a sixteen byte store.  The last store
+  can go RGB_SLACK bytes past the end of the row.
+  
+  @param r The red plane's row.
+  @param g The green plane's row.
+  @param b The blue plane's row.
+  @param width The number of pixels in the row.
+  @param out Where to put the pixels, with room for 3 * width plus
+  RGB_SLACK bytes.
+*/
+static void interleaveRow( const unsigned char *r, const unsigned char *g,
+    const unsigned char *b, int width, unsigned char *out )
+{
+  int i = 0;
+#if defined( __SSE2__ )
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i low = _mm_set1_epi64x( 0xFFFFFF );
+  const __m128i high = _mm_set1_epi64x( 0xFFFFFF000000 );
+  const __m128i first = _mm_set_epi32( 0, 0, 0xFFFF, -1 );
+  const __m128i second = _mm_set_epi32( 0, -1, 0xFFFF0000, 0 );
+  for ( ; i + 16 <= width; i += 16 ) {
+    __m128i vr = _mm_loadu_si128( (const __m128i *) ( r + i ) );
+    __m128i vg = _mm_loadu_si128( (const __m128i *) ( g + i ) );
+    __m128i vb = _mm_loadu_si128( (const __m128i *) ( b + i ) );
+    __m128i rg[ 2 ] = { _mm_unpacklo_epi8( vr, vg ), _mm_unpackhi_epi8( vr, vg ) };
+    __m128i b0[ 2 ] = { _mm_unpacklo_epi8( vb, zero ), _mm_unpackhi_epi8( vb, zero ) };
+    for ( int h = 0; h < 4; h++ ) {
+      //Four pixels as r g b 0, then six bytes in each half, then twelve
+      __m128i v = h % 2 == 0 ? _mm_unpacklo_epi16( rg[ h / 2 ], b0[ h / 2 ] )
+        : _mm_unpackhi_epi16( rg[ h / 2 ], b0[ h / 2 ] );
+      v = _mm_or_si128( _mm_and_si128( v, low ),
+                        _mm_and_si128( _mm_srli_epi64( v, 8 ), high ) );
+      v = _mm_or_si128( _mm_and_si128( v, first ),
+                        _mm_and_si128( _mm_srli_si128( v, 2 ), second ) );
+      _mm_storeu_si128( (__m128i *) ( out + 3 * i + 12 * h ), v );
+    }
+  }
+#endif
+  for ( ; i < width; i++ ) {
+    out[ 3 * i ] = r[ i ];
+    out[ 3 * i + 1 ] = g[ i ];
+    out[ 3 * i + 2 ] = b[ i ];
+  }
+}
+
+/**
+  Writes a greyscale image as a raw P6 file, with each pixel's level
+  in all three channels.
+  
+  @param src The image that is being saved.
+  @param outputFile The file where data is being wrote to.
+*/
+static void savePixmap( RowSource *src, FILE *outputFile )
+{
+  unsigned char *out = (unsigned char *) malloc( (size_t) src->width * 3 + RGB_SLACK );
+  fprintf( outputFile, "P6\n%d %d\n255\n", src->width, src->height );
+  for ( int k = 0; k < src->height; k++ ) {
+    bool repeat;
+    const unsigned char *row = sourceRow( src, k, &repeat );
+    if ( !repeat )
+      interleaveRow( row, row, row, src->width, out );
+    fwrite( out, 1, (size_t) src->width * 3, outputFile );
+  }
+  free( out );
+}
+
+void saveRgbImage( const RgbCanvas *image, FILE *outputFile )
+{
+  unsigned char *out = (unsigned char *) malloc( (size_t) image->width * 3 + RGB_SLACK );
+  fprintf( outputFile, "P6\n%d %d\n255\n", image->width, image->height );
+  for ( int k = 0; k < image->height; k++ ) {
+    interleaveRow( canvasRow( image->planes[ 0 ], k ), canvasRow( image->planes[ 1 ], k ),
+                   canvasRow( image->planes[ 2 ], k ), image->width, out );
+    fwrite( out, 1, (size_t) image->width * 3, outputFile );
+  }
+  free( out );
+}
+
+/**
+  This function writes an image in the given format.
+  
+  @param src The image that is being saved.
+  @param outputFile The file where data is being wrote to.
+  @param format Which PGM format to write.
+*/
+static void saveRows( RowSource *src, FILE *outputFile, ImageFormat format )
+{
+  if ( format == FORMAT_P5 )
+    saveBinary( src, outputFile );
+  else if ( format == FORMAT_RLE )
+    saveRuns( src, outputFile );
+  else if ( format == FORMAT_PNG )
+    savePng( src, outputFile );
+  else if ( format == FORMAT_P6 )
+    savePixmap( src, outputFile );
+  else
+    saveText( src, outputFile );
 }
 
 /**
@@ -34,41 +409,143 @@ void clearImage( unsigned char image [ WIDTH ] [ HEIGHT ], unsigned char color )
   
   @param image The image that is being saved.
   @param outputFile The file where data is being wrote to.
+  @param format Which PGM format to write.
 */
-void saveImage( unsigned char image [ WIDTH ] [ HEIGHT ], FILE *outputFile )
+void saveImage( const Canvas *image, FILE *outputFile, ImageFormat format )
+{
+  RowSource src = { image->width, image->height, image, NULL, NULL, false };
+  saveRows( &src, outputFile, format );
+}
+
+bool updateImage( const Canvas *image, int fd, ImageFormat format )
 {
-  //Header stuff for pgm file type
-  fprintf( outputFile, "P2\n" );
-  fprintf( outputFile, "%d %d\n255\n", WIDTH - 1, HEIGHT - 1 );
+  char header[ HEADER_SIZE ];
+  int headerLen = snprintf( header, sizeof( header ), "P%c\n%d %d\n255\n",
+                            format == FORMAT_P5 ? '5' : '2', image->width, image->height );
+  size_t rowBytes = format == FORMAT_P5 ? (size_t) image->width
+    : (size_t) image->width * PIXEL_TEXT;
+  size_t capacity = rowBytes > TEXT_BUFFER ? rowBytes : TEXT_BUFFER;
+  char *buffer = (char *) malloc( capacity );
+  bool ok = buffer != NULL;
   
-  //Loops to traverse the array of the picture
-  for ( int k = 0; k <= HEIGHT - 2; k++ ) {
-    for ( int i = 0; i <= WIDTH - 2; i++ ) {
+  //Each run of changed rows is put together and written with one pwrite
+  int k = 0;
+  while ( ok && k < image->height ) {
+    if ( !image->dirty[ k ] ) {
+      k++;
+      continue;
+    }
     
-      //Determines correct spacing for the file
-      if ( (int)image[i][k] < 10 ) {
-        fprintf( outputFile, "  %d", (int)image[i][k] );
-      } else if ( (int)image[i][k] >= 10 && (int)image[i][k] < 100 ) {
-        fprintf( outputFile, " %d", (int)image[i][k] );
-      } else {
-        fprintf( outputFile, "%d", (int)image[i][k] );
-      }
-      
-      //Stops spacing at end of line
-      if ( i < WIDTH - 1 )
-        fprintf( outputFile, " " );
+    int first = k;
+    size_t len = 0;
+    for ( ; k < image->height && image->dirty[ k ] && len + rowBytes <= capacity; k++ ) {
+      if ( format == FORMAT_P5 )
+        memcpy( buffer + len, canvasRow( image, k ), rowBytes );
+      else
+        encodeRow( canvasRow( image, k ), image->width, buffer + len );
+      len += rowBytes;
+    }
+    
+    off_t offset = headerLen + (off_t) first * rowBytes;
+    for ( size_t done = 0; ok && done < len; ) {
+      ssize_t n = pwrite( fd, buffer + done, len - done, offset + done );
+      ok = n > 0;
+      done += ok ? n : 0;
     }
-  
-  fprintf( outputFile, "\n" );
   }
   
-  //Closes the outputFile
-  //fclose(outputFile);
+  free( buffer );
+  return ok;
+}
+
+void saveTiledImage( const TiledCanvas *image, FILE *outputFile, ImageFormat format )
+{
+  RowSource src = { image->width, image->height, NULL, image, NULL, false };
+  src.scratch = (unsigned char *) malloc( (size_t) image->cols * TILE_SIZE );
+  saveRows( &src, outputFile, format );
+  free( src.scratch );
+}
+
+/**
+  Fills part of one row of the image.  The span must already be
+  clipped to the image.
+  
+  @param image The image that is being drawn on.
+  @param y The row to fill.
+  @param x0 The first pixel to fill.
+  @param x1 The last pixel to fill.
+  @param color The color to fill with.
+*/
+static void fillRow( Canvas *image, int y, int x0, int x1, unsigned char color )
+{
+  fillSpan( image, y, x0, x1 + 1, color );
+}
+
+/**
+  Returns the coordinate along the minor axis at step i of a line of n
+  steps, rounded the way round() rounds, with halfway cases going away
+  from zero.  The exact value is start + delta * i / n.  The products
+  can need more than 64 bits for a line between the far corners of the
+  int range, so they are worked out in 128.
+  
+  @param start The starting coordinate.
+  @param delta The change in the coordinate over the whole line.
+  @param n The number of steps in the line.
+  @param i The step.
+  @return The rounded coordinate.
+*/
+static long long minorAt( long long start, long long delta, long long n, long long i )
+{
+  __int128 v = (__int128) start * n + (__int128) delta * i;
+  if ( v >= 0 )
+    return ( 2 * v + n ) / ( 2 * n );
+  return -( ( -2 * v + n ) / ( 2 * n ) );
+}
+
+/**
+  Finds the first step in lo .. hi where the minor coordinate of a line
+  is at least, or at most, the given bound.  The minor coordinate only
+  moves one way, so this is a binary search.
+  
+  @param start The starting minor coordinate.
+  @param delta The change in the minor coordinate over the whole line.
+  @param n The number of steps in the line.
+  @param lo The first step to consider.
+  @param hi The last step to consider.
+  @param bound The bound to compare with.
+  @param atLeast True to look for a coordinate >= bound, false for <= bound.
+  @return The first step that passes, or hi + 1 if none does.
+*/
+static long long firstStep( long long start, long long delta, long long n,
+    long long lo, long long hi, long long bound, bool atLeast )
+{
+  hi++;
+  while ( lo < hi ) {
+    long long mid = lo + ( hi - lo ) / 2;
+    long long m = minorAt( start, delta, n, mid );
+    if ( atLeast ? m >= bound : m <= bound )
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return lo;
 }
 
 /**
   This function is used to draw a line on the picture based on
-  what is read from the file.
+  what is read from the file.  It makes the same pixels the original
+  floating point version did, which stepped one pixel at a time along
+  the longer axis and rounded the other coordinate, but it uses only
+  integers.  The steps that land on the image are found first, so
+  nothing is spent on the part of the line that is off the image, and
+  then the rounded coordinate is carried along with a remainder the way
+  Bresenham's algorithm does it.  Horizontal and vertical lines are
+  filled directly.
+  
+  The one place the pixels can differ is a step that lands exactly
+  halfway between two pixels.  This version always rounds it away from
+  zero, like round() does, while the old one got whichever side the
+  floating point error in ydiff * i happened to put it on.
   
   @param image The image that is being drawn on.
   @param x1 This is the first x value of the line.
@@ -77,45 +554,200 @@ void saveImage( unsigned char image [ WIDTH ] [ HEIGHT ], FILE *outputFile )
   @param y2 This is the second y value of the line.
   @param color This is the color that the line will be.
 */
-void drawLine( unsigned char image [ WIDTH ] [ HEIGHT ], int x1,
-    int y1, int x2, int y2, unsigned char color )
+void drawLine( Canvas *image, int x1, int y1, int x2, int y2, unsigned char color )
 {
-  int dx = x2 - x1;//Change in x
-  int dy = y2 - y1;//Change in y
+  Rect all = { image->originX, image->originY,
+               image->originX + image->width, image->originY + image->height };
+  drawLineClipped( image, &all, x1, y1, x2, y2, color, NULL );
+}
+
+/**
+  Returns which sides of a clip rectangle a point is outside of, one bit
+  for each side, the way Cohen-Sutherland clipping does.
   
-  //Determine the largest change
-  int larger = 0;
-  if ( abs( dx ) > abs( dy ) ) {
-    larger = abs( dx ) + 1;
+  @param x The x value of the point.
+  @param y The y value of the point.
+  @param clip The clip rectangle.
+  @return The outcode of the point, zero if it is inside.
+*/
+static int outcode( long long x, long long y, const Rect *clip )
+{
+  return ( x < clip->x0 ) | ( x >= clip->x1 ) << 1
+    | ( y < clip->y0 ) << 2 | ( y >= clip->y1 ) << 3;
+}
+
+long long drawLineClipped( Canvas *image, const Rect *clip, int x1, int y1,
+    int x2, int y2, unsigned char color, long long *visited )
+{
+  //A line with both ends past the same side can't reach the rectangle
+  if ( outcode( x1, y1, clip ) & outcode( x2, y2, clip ) )
+    return 0;
+  
+  long long dx = (long long) x2 - x1;//Change in x
+  long long dy = (long long) y2 - y1;//Change in y
+  
+  //Determine the largest change, which is the number of steps
+  long long n = llabs( dx ) > llabs( dy ) ? llabs( dx ) : llabs( dy );
+  
+  //The floating point version divided zero by zero for a line with no
+  //length and never drew anything, so neither does this one
+  if ( n == 0 )
+    return 0;
+  
+  //Horizontal lines are a single span
+  if ( dy == 0 ) {
+    if ( y1 < clip->y0 || y1 >= clip->y1 )
+      return 0;
+    long long left = x1 < x2 ? x1 : x2;
+    long long right = x1 < x2 ? x2 : x1;
+    if ( left < clip->x0 )
+      left = clip->x0;
+    if ( right > clip->x1 - 1 )
+      right = clip->x1 - 1;
+    if ( left > right )
+      return 0;
+    fillRow( image, y1, left, right, color );
+    if ( visited )
+      *visited += right - left + 1;
+    return right - left + 1;
+  }
+  
+  //Vertical lines are one pixel in each row
+  if ( dx == 0 ) {
+    if ( x1 < clip->x0 || x1 >= clip->x1 )
+      return 0;
+    long long top = y1 < y2 ? y1 : y2;
+    long long bottom = y1 < y2 ? y2 : y1;
+    if ( top < clip->y0 )
+      top = clip->y0;
+    if ( bottom > clip->y1 - 1 )
+      bottom = clip->y1 - 1;
+    for ( long long k = top; k <= bottom; k++ )
+      *canvasPixel( image, x1, k ) = color;
+    if ( visited && top <= bottom )
+      *visited += bottom - top + 1;
+    return top <= bottom ? bottom - top + 1 : 0;
+  }
+  
+  //The major axis moves exactly one pixel per step; when both axes
+  //change by the same amount, either one works
+  bool xMajor = llabs( dx ) == n;
+  long long a1 = xMajor ? x1 : y1;//Start on the major axis
+  long long b1 = xMajor ? y1 : x1;//Start on the minor axis
+  long long db = xMajor ? dy : dx;//Change on the minor axis
+  int step = ( xMajor ? dx : dy ) > 0 ? 1 : -1;
+  
+  //Range of coordinates allowed on each axis
+  long long aMin = xMajor ? clip->x0 : clip->y0;
+  long long aMax = ( xMajor ? clip->x1 : clip->y1 ) - 1;
+  long long bMin = xMajor ? clip->y0 : clip->x0;
+  long long bMax = ( xMajor ? clip->y1 : clip->x1 ) - 1;
+  
+  //Clips the steps so the major coordinate stays in the clip rectangle
+  long long lo = 0;
+  long long hi = n;
+  if ( step > 0 ) {
+    if ( aMin - a1 > lo )
+      lo = aMin - a1;
+    if ( aMax - a1 < hi )
+      hi = aMax - a1;
   } else {
-    larger = abs( dy ) + 1;
+    if ( a1 - aMax > lo )
+      lo = a1 - aMax;
+    if ( a1 - aMin < hi )
+      hi = a1 - aMin;
   }
+  if ( lo > hi )
+    return 0;
   
-  //Determines the change in each test point
-  double xdiff = (x2 - x1) / (double)(larger - 1);
-  double ydiff = (y2 - y1) / (double)(larger - 1);
+  //Clips them again so the minor coordinate stays in it too
+  if ( db > 0 ) {
+    lo = firstStep( b1, db, n, lo, hi, bMin, true );
+    hi = firstStep( b1, db, n, lo, hi, bMax + 1, true ) - 1;
+  } else {
+    lo = firstStep( b1, db, n, lo, hi, bMax, false );
+    hi = firstStep( b1, db, n, lo, hi, bMin - 1, false ) - 1;
+  }
+  if ( lo > hi )
+    return 0;
   
-  //Point x & y to plot colors too
-  double x;
-  double y;
+  //Since the minor coordinate is never negative from here on, it is
+  //num / den rounded down, with num = 2 * ( b1 * n + db * i ) + n.  The
+  //quotient and remainder fit in 64 bits once clipped, but num may not.
+  long long den = 2 * n;
+  __int128 num = 2 * ( (__int128) b1 * n + (__int128) db * lo ) + n;
+  long long b = num / den;
+  long long rem = num % den;
+  long long a = a1 + step * lo;
   
-  for ( int i = 0; i < larger; i++ ){
-    //finds the points x and y
-    x = (double)x1 + ( xdiff * i );
-    y = (double)y1 + ( ydiff * i );
+  long long runStart = a;//First step of the run on the current row
+  for ( long long i = lo; i <= hi; i++ ) {
+    long long last = a;
+    long long row = b;
+    if ( !xMajor )
+      *canvasPixel( image, b, a ) = color;
     
-    //Changes the color at the points on the line
-    if ( (int)round(x) >= 0 && (int)round(x) < WIDTH 
-          && (int)round(y) >= 0 && (int)round(y) < HEIGHT ) {
-      image[ (int)round(x) ][ (int)round(y) ] = color;
-    }//Closes if statement
-  }//Closes for loop
-
+    //Moves to the next step; the remainder changes by at most den
+    a += step;
+    rem += 2 * db;
+    if ( rem >= den ) {
+      rem -= den;
+      b++;
+    } else if ( rem < 0 ) {
+      rem += den;
+      b--;
+    }
+    
+    //Steps of a mostly horizontal line that stay on one row are
+    //filled as a single span when the line leaves the row
+    if ( xMajor && ( b != row || i == hi ) ) {
+      if ( step > 0 )
+        fillRow( image, row, runStart, last, color );
+      else
+        fillRow( image, row, last, runStart, color );
+      runStart = a;
+    }
+  }
+  
+  //Every step sets one pixel
+  if ( visited )
+    *visited += hi - lo + 1;
+  return hi - lo + 1;
 }//Closes drawLine function
 
+/**
+  Returns the integer square root of a number, the largest r with
+  r * r <= n.
+  
+  @param n The number, which must not be negative.
+  @return The integer square root.
+*/
+static long long isqrt( long long n )
+{
+  if ( n < 2 )
+    return n;
+  
+  //The floating point root is off by at most one for any n that fits,
+  //so it just needs fixing up
+  long long r = (long long) sqrt( (double) n );
+  while ( r * r > n )
+    r--;
+  while ( ( r + 1 ) * ( r + 1 ) <= n )
+    r++;
+  return r;
+}
+
 /**
   This function is used to draw a circle on the picture based on
-  what is read from the file.
+  what is read from the file.  It fills the same pixels as testing every
+  point in the square around the circle, the points (i, k) with
+  cx - radius <= i < cx + radius, cy - radius <= k < cy + radius and
+  (i - cx)^2 + (k - cy)^2 < radius^2, but a row at a time.  For each
+  row on the image, the half width h of the circle is the largest value
+  with h^2 < radius^2 - (k - cy)^2.  It is found with a square root for
+  the first row and then moved a little for each row after that, unless
+  it changes too much to step, and the row is filled with one span.
+  Only the rows inside the image are looked at.
   
   @param image The image that is being drawn on.
   @param cx The center x value for the circle.
@@ -123,28 +755,274 @@ void drawLine( unsigned char image [ WIDTH ] [ HEIGHT ], int x1,
   @param radius The radius the circle is going to be.
   @param color The color that the circle will be.
 */
-void drawCircle( unsigned char image [ WIDTH ] [ HEIGHT ], int cx,
-    int cy, int radius, unsigned char color )
+void drawCircle( Canvas *image, int cx, int cy, int radius, unsigned char color )
 {
-  if ( radius == 0 )
-    return;
-  int xsqrd;//Current x squared
-  int ysqrd;//Current y squared
-  int rsqrd = radius * radius;//Radius squared
-  
-  //Two for loops to traverse through the points of the circle
-  for ( int i = cx - radius; i < cx + radius; i++ ) {
-    for (int k = cy - radius; k < cy + radius; k++ ) {
-      //Finds (x-h)^2 and (y-k)^2
-      xsqrd = (i - cx) * (i - cx);
-      ysqrd = (k - cy) * (k - cy);
-
-      //Checks to see if it can draw the point in the circle
-      if ( xsqrd + ysqrd < rsqrd ){
-        //Bounds checking for the image
-        if ( i >= 0 && i < WIDTH && k >= 0 && k < HEIGHT )
-          image[i][k] = color;
+  Rect all = { image->originX, image->originY,
+               image->originX + image->width, image->originY + image->height };
+  drawCircleClipped( image, &all, cx, cy, radius, color, NULL );
+}
+
+long long drawCircleClipped( Canvas *image, const Rect *clip, int cx, int cy,
+    int radius, unsigned char color, long long *visited )
+{
+  if ( radius <= 0 )
+    return 0;
+  long long rsqrd = (long long) radius * radius;//Radius squared
+  
+  //Nothing to do if the circle's box misses the rectangle
+  if ( (long long) cx + radius <= clip->x0 || (long long) cx - radius >= clip->x1 )
+    return 0;
+  
+  //Rows of the circle that are in the clip rectangle
+  long long top = (long long) cy - radius;
+  long long bottom = (long long) cy + radius - 1;
+  if ( top < clip->y0 )
+    top = clip->y0;
+  if ( bottom > clip->y1 - 1 )
+    bottom = clip->y1 - 1;
+  if ( top > bottom )
+    return 0;
+  
+  //Half width for the first row; h^2 < m, so h is one less than the
+  //square root of m rounded up
+  long long dy = top - cy;
+  long long m = rsqrd - dy * dy;
+  long long h = m > 0 ? isqrt( m - 1 ) : -1;
+  long long set = 0;
+  long long empty = 0;//Rows that set nothing
+  
+  for ( long long k = top; k <= bottom; k++ ) {
+    dy = k - cy;
+    long long last = m;
+    m = rsqrd - dy * dy;
+    
+    //Near the top and bottom of a big circle the half width jumps by a
+    //lot from one row to the next, so it is found over again instead of
+    //being stepped there a pixel at a time
+    if ( m - last > 8 * ( h + 1 ) || last - m > 8 * ( h + 1 ) )
+      h = m > 0 ? isqrt( m - 1 ) : -1;
+    
+    //Grows the half width toward the middle and shrinks it after
+    while ( ( h + 1 ) * ( h + 1 ) < m )
+      h++;
+    while ( h >= 0 && h * h >= m )
+      h--;
+    
+    if ( h >= 0 ) {
+      long long left = cx - h;
+      long long right = cx + h;
+      if ( left < clip->x0 )
+        left = clip->x0;
+      if ( right > clip->x1 - 1 )
+        right = clip->x1 - 1;
+      if ( left <= right ) {
+        fillRow( image, k, left, right, color );
+        set += right - left + 1;
+        continue;
       }
     }
+    empty++;
   }
+  if ( visited )
+    *visited += set + empty;
+  return set;
+}
+
+long long drawRectClipped( Canvas *image, const Rect *clip, int x1, int y1,
+    int x2, int y2, unsigned char color, long long *visited )
+{
+  Rect r;
+  r.x0 = x1 < x2 ? x1 : x2;
+  r.x1 = x1 < x2 ? x2 : x1;
+  r.y0 = y1 < y2 ? y1 : y2;
+  r.y1 = y1 < y2 ? y2 : y1;
+  if ( r.x0 < clip->x0 )
+    r.x0 = clip->x0;
+  if ( r.x1 > clip->x1 )
+    r.x1 = clip->x1;
+  if ( r.y0 < clip->y0 )
+    r.y0 = clip->y0;
+  if ( r.y1 > clip->y1 )
+    r.y1 = clip->y1;
+  if ( r.x1 <= r.x0 || r.y1 <= r.y0 )
+    return 0;
+  fillRect( image, &r, color );
+  if ( visited )
+    *visited += (long long) ( r.x1 - r.x0 ) * ( r.y1 - r.y0 );
+  return (long long) ( r.x1 - r.x0 ) * ( r.y1 - r.y0 );
+}
+
+//One edge of a polygon that isn't horizontal, going down from row top
+//to just before row end.  On the current row, the edge crosses the
+//middle of the row at x - r / den, so x is the first pixel whose center
+//is right of it.
+typedef struct {
+  int top;
+  int end;
+  long long x;
+  long long r;
+  long long den;
+  
+  //What x and r change by from one row to the next
+  long long step;
+  long long rem;
+  
+  //Upper corner of the edge and how far it goes
+  long long x0;
+  long long dx;
+  long long dy;
+} Edge;
+
+/**
+  This function orders edges by the row they start on, for qsort.
+*/
+static int compareEdges( const void *a, const void *b )
+{
+  int ta = ( (const Edge *) a )->top;
+  int tb = ( (const Edge *) b )->top;
+  return ( ta > tb ) - ( ta < tb );
+}
+
+/**
+  This function divides rounding down, for a positive divisor.
+  
+  @param a The number to divide.
+  @param b The number to divide by, which is positive.
+  @return a / b rounded down.
+*/
+static long long floorDivide( long long a, long long b )
+{
+  long long q = a / b;
+  return a % b < 0 ? q - 1 : q;
+}
+
+/**
+  This function puts an edge on a row.  The middle of row y is
+  ( 2 * ( y - top ) + 1 ) / 2 below the upper corner, where the edge is
+  dx times that over dy to the right of it, so the first pixel center
+  right of the edge is at x0 plus that distance less a half, rounded up.
+  
+  @param e The edge.
+  @param y The row, which the edge must cross.
+*/
+static void startEdge( Edge *e, long long y )
+{
+  long long num = ( 2 * ( y - e->top ) + 1 ) * e->dx - e->dy;
+  long long q = -floorDivide( -num, e->den );
+  e->x = e->x0 + q;
+  e->r = q * e->den - num;
+}
+
+long long drawPolygonClipped( Canvas *image, const Rect *clip, const int *points,
+    int count, unsigned char color, long long *visited )
+{
+  //Nothing to do if the corners are all left or all right of the
+  //rectangle; rows above or below it never get edges
+  int left = points[0];
+  int right = points[0];
+  for ( int i = 1; i < count; i++ ) {
+    left = points[ 2 * i ] < left ? points[ 2 * i ] : left;
+    right = points[ 2 * i ] > right ? points[ 2 * i ] : right;
+  }
+  if ( right <= clip->x0 || left >= clip->x1 )
+    return 0;
+  
+  //The edge table, holding the edges that cross rows in the clip
+  //rectangle, in the order they start
+  Edge *edges = (Edge *) malloc( count * sizeof( Edge ) );
+  Edge **active = (Edge **) malloc( count * sizeof( Edge * ) );
+  int n = 0;
+  int bottom = clip->y0;
+  for ( int i = 0; i < count; i++ ) {
+    const int *p = points + 2 * i;
+    const int *q = points + 2 * ( i + 1 < count ? i + 1 : 0 );
+    if ( p[1] == q[1] )
+      continue;
+    const int *upper = p[1] < q[1] ? p : q;
+    const int *lower = p[1] < q[1] ? q : p;
+    if ( lower[1] <= clip->y0 || upper[1] >= clip->y1 )
+      continue;
+    
+    Edge *e = edges + n++;
+    e->top = upper[1];
+    e->end = lower[1];
+    e->x0 = upper[0];
+    e->dx = (long long) lower[0] - upper[0];
+    e->dy = (long long) lower[1] - upper[1];
+    e->den = 2 * e->dy;
+    e->step = floorDivide( 2 * e->dx, e->den );
+    e->rem = 2 * e->dx - e->step * e->den;
+    if ( e->end > bottom )
+      bottom = e->end;
+  }
+  qsort( edges, n, sizeof( Edge ), compareEdges );
+  if ( bottom > clip->y1 )
+    bottom = clip->y1;
+  
+  //Walks down the rows, keeping the list of edges that cross the row
+  //sorted by where they cross it and filling between each pair
+  int next = 0;
+  int live = 0;
+  long long set = 0;
+  long long empty = 0;//Rows walked that set nothing
+  long long y = n > 0 && edges[ 0 ].top > clip->y0 ? edges[ 0 ].top : clip->y0;
+  for ( ; y < bottom; y++ ) {
+    int kept = 0;
+    for ( int i = 0; i < live; i++ )
+      if ( active[ i ]->end > y )
+        active[ kept++ ] = active[ i ];
+    live = kept;
+    
+    for ( ; next < n && edges[ next ].top <= y; next++ ) {
+      startEdge( edges + next, y );
+      active[ live++ ] = edges + next;
+    }
+    if ( live == 0 ) {
+      if ( next == n )
+        break;
+      y = edges[ next ].top - 1;
+      continue;
+    }
+    
+    //The edges hardly ever change order between rows, so this is
+    //usually just one pass
+    for ( int i = 1; i < live; i++ ) {
+      Edge *e = active[ i ];
+      int j = i;
+      for ( ; j > 0 && active[ j - 1 ]->x > e->x; j-- )
+        active[ j ] = active[ j - 1 ];
+      active[ j ] = e;
+    }
+    
+    long long before = set;
+    for ( int i = 0; i + 1 < live; i += 2 ) {
+      long long left = active[ i ]->x;
+      long long right = active[ i + 1 ]->x;
+      if ( left < clip->x0 )
+        left = clip->x0;
+      if ( right > clip->x1 )
+        right = clip->x1;
+      if ( left < right ) {
+        fillSpan( image, y, left, right, color );
+        set += right - left;
+      }
+    }
+    empty += set == before;
+    
+    for ( int i = 0; i < live; i++ ) {
+      Edge *e = active[ i ];
+      e->x += e->step;
+      e->r -= e->rem;
+      if ( e->r < 0 ) {
+        e->x++;
+        e->r += e->den;
+      }
+    }
+  }
+  
+  free( active );
+  free( edges );
+  if ( visited )
+    *visited += set + empty;
+  return set;
 }
@@ -5,14 +5,21 @@
   This is the header file for the image.c file.
   This just outlines the functions in the .c file
 */
-#include <stdio.h>
+#ifndef _IMAGE_H_
+#define _IMAGE_H_
 
-//Defines a WIDTH and HEIGHT for the picture array
-#define WIDTH 256
-#define HEIGHT 256
+#include <stdio.h>
+#include <stdbool.h>
+#include "canvas.h"
 
-//Declares the global variable for the array
-extern unsigned char picture[ WIDTH ][ HEIGHT ];
+//Output formats that saveImage can write
+typedef enum {
+  FORMAT_P2,  //Plain (ASCII) PGM
+  FORMAT_P5,  //Raw (binary) PGM
+  FORMAT_RLE, //Raw PGM with each row run-length encoded
+  FORMAT_PNG, //Greyscale PNG
+  FORMAT_P6   //Raw (binary) color PPM
+} ImageFormat;
 
 /**
   This function is used to clear the image.  It sets all the pixels to one
@@ -21,7 +28,7 @@ extern unsigned char picture[ WIDTH ][ HEIGHT ];
   @param image The image that is being edited.
   @param color The color that is being put on all pixels.
 */
-void clearImage( unsigned char image [ WIDTH ] [ HEIGHT ], unsigned char color );
+void clearImage( Canvas *image, unsigned char color );
 
 /**
   This function is used to save the image to the output file
@@ -29,8 +36,43 @@ void clearImage( unsigned char image [ WIDTH ] [ HEIGHT ], unsigned char color )
   
   @param image The image that is being saved.
   @param outputFile The file where data is being wrote to.
+  @param format Which PGM format to write.
+*/
+void saveImage( const Canvas *image, FILE *outputFile, ImageFormat format );
+
+/**
+  This function saves a color canvas as a raw P6 file.  The planes are
+  interleaved into red, green, blue triples a row at a time as the file
+  is written.
+  
+  @param image The image that is being saved.
+  @param outputFile The file where data is being wrote to.
+*/
+void saveRgbImage( const RgbCanvas *image, FILE *outputFile );
+
+/**
+  This function saves a tiled canvas, writing exactly what saveImage
+  would write for the same pixels.
+  
+  @param image The image that is being saved.
+  @param outputFile The file where data is being wrote to.
+  @param format Which PGM format to write.
+*/
+void saveTiledImage( const TiledCanvas *image, FILE *outputFile, ImageFormat format );
+
+/**
+  This function updates an image file in place, rewriting only the rows
+  of the canvas that are marked as changed.  The file must already hold
+  the canvas as it was before drawing, laid out exactly as saveImage
+  writes it, so every row is at a known offset.  This works for P2 as
+  well as P5, since every pixel takes the same number of characters.
+  
+  @param image The image that is being saved, tracking its changes.
+  @param fd The file being updated, open for writing.
+  @param format The format of the file.
+  @return False if writing failed.
 */
-void saveImage( unsigned char image [ WIDTH ] [ HEIGHT ], FILE *outputFile );
+bool updateImage( const Canvas *image, int fd, ImageFormat format );
 
 /**
   This function is used to draw a line on the picture based on
@@ -43,8 +85,27 @@ void saveImage( unsigned char image [ WIDTH ] [ HEIGHT ], FILE *outputFile );
   @param y2 This is the second y value of the line.
   @param color This is the color that the line will be.
 */
-void drawLine( unsigned char image [ WIDTH ] [ HEIGHT ], int x1,
-    int y1, int x2, int y2, unsigned char color );
+void drawLine( Canvas *image, int x1, int y1, int x2, int y2, unsigned char color );
+
+/**
+  This function draws the part of a line that falls inside a rectangle
+  of the picture.  The pixels are exactly the ones drawLine would draw
+  there, so drawing a line in pieces gives the same picture.
+  
+  @param image The image that is being drawn on.
+  @param clip The part of the image to draw in, which must be on the image.
+  @param x1 This is the first x value of the line.
+  @param y1 This is the first y value of the line.
+  @param x2 This is the second x value of the line.
+  @param y2 This is the second y value of the line.
+  @param color This is the color that the line will be.
+  @param visited If not NULL, the number of pixels looked at is added to
+  it: every pixel set, plus one for each row or step that was worked
+  out but set nothing.
+  @return The number of pixels set.
+*/
+long long drawLineClipped( Canvas *image, const Rect *clip, int x1, int y1,
+    int x2, int y2, unsigned char color, long long *visited );
 
 /**
   This function is used to draw a circle on the picture based on
@@ -56,5 +117,69 @@ void drawLine( unsigned char image [ WIDTH ] [ HEIGHT ], int x1,
   @param radius The radius the circle is going to be.
   @param color The color that the circle will be.
 */
-void drawCircle( unsigned char image [ WIDTH ] [ HEIGHT ], int cx,
-    int cy, int radius, unsigned char color );
+void drawCircle( Canvas *image, int cx, int cy, int radius, unsigned char color );
+
+/**
+  This function draws the part of a circle that falls inside a rectangle
+  of the picture, exactly as drawCircle would draw it there.
+  
+  @param image The image that is being drawn on.
+  @param clip The part of the image to draw in, which must be on the image.
+  @param cx The center x value for the circle.
+  @param cy The center y value for the circle.
+  @param radius The radius the circle is going to be.
+  @param color The color that the circle will be.
+  @param visited If not NULL, the number of pixels looked at is added to
+  it: every pixel set, plus one for each row or step that was worked
+  out but set nothing.
+  @return The number of pixels set.
+*/
+long long drawCircleClipped( Canvas *image, const Rect *clip, int cx, int cy,
+    int radius, unsigned char color, long long *visited );
+
+/**
+  This function fills the part of a rectangle that falls inside a
+  rectangle of the picture.  Like a polygon, it fills the pixels whose
+  centers are inside it, so x1 and y1 are included and x2 and y2 aren't
+  when x1 < x2 and y1 < y2.  The corners can be given in any order.
+  
+  @param image The image that is being drawn on.
+  @param clip The part of the image to draw in, which must be on the image.
+  @param x1 This is the x value of one corner.
+  @param y1 This is the y value of one corner.
+  @param x2 This is the x value of the opposite corner.
+  @param y2 This is the y value of the opposite corner.
+  @param color This is the color that the rectangle will be.
+  @param visited If not NULL, the number of pixels looked at is added to
+  it: every pixel set, plus one for each row or step that was worked
+  out but set nothing.
+  @return The number of pixels set.
+*/
+long long drawRectClipped( Canvas *image, const Rect *clip, int x1, int y1,
+    int x2, int y2, unsigned char color, long long *visited );
+
+/**
+  This function fills the part of a polygon that falls inside a
+  rectangle of the picture.  A pixel is filled if its center is inside
+  the polygon by the even-odd rule, with centers exactly on a left or
+  top edge counting as inside and ones on a right or bottom edge not, so
+  polygons that share an edge never both fill a pixel.  Each row is
+  found from the edges that cross it, and only rows in the clip
+  rectangle are looked at, so drawing a polygon in pieces gives the same
+  picture as drawing it all at once.
+  
+  @param image The image that is being drawn on.
+  @param clip The part of the image to draw in, which must be on the image.
+  @param points The corners of the polygon as x y pairs, each within
+  MAX_POLYGON_COORD of zero.
+  @param count The number of corners.
+  @param color This is the color that the polygon will be.
+  @param visited If not NULL, the number of pixels looked at is added to
+  it: every pixel set, plus one for each row or step that was worked
+  out but set nothing.
+  @return The number of pixels set.
+*/
+long long drawPolygonClipped( Canvas *image, const Rect *clip, const int *points,
+    int count, unsigned char color, long long *visited );
+
+#endif
@@ -0,0 +1,298 @@
+/**
+  @file load.c
+  @author Jesse Liddle (jaliddl2)
+
+  This file reads PGM images.
+*/
+#include "load.h"
+#include "mapfile.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stddef.h>
+
+//Largest pixel value
+#define MAX_COLOR 255
+
+//Characters saveImage writes for each pixel in a P2 file
+#define PIXEL_TEXT 4
+
+//Room for the longest PGM header saveImage writes
+#define HEADER_SIZE 64
+
+//What the header of a PGM file says about the image
+typedef struct {
+  //True for P5, false for P2
+  bool binary;
+  int width;
+  int height;
+  int maxValue;
+} Header;
+
+//Where the reader is in the text of a file
+typedef struct {
+  const char *p;
+  const char *end;
+  
+  //Start of the pixels and number of pixels read so far
+  const char *pixels;
+  size_t count;
+  
+  //Stays true while the file is laid out exactly as saveImage writes it
+  bool exact;
+} Reader;
+
+/**
+  This function tells if a character is whitespace in a PGM file.
+  
+  @param c The character.
+  @return True if it's whitespace.
+*/
+static inline bool isSpace( char c )
+{
+  return c == ' ' || ( c >= '\t' && c <= '\r' );
+}
+
+/**
+  This function reads an unsigned number, skipping whitespace in front
+  of it.  Comments, from # to the end of a line, count as whitespace
+  too.
+  
+  @param r The reader, which is moved past the number.
+  @param value Filled in with the number.
+  @return False if there isn't a number there or it doesn't fit in an int.
+*/
+static bool readNumber( Reader *r, int *value )
+{
+  while ( r->p < r->end && ( isSpace( *r->p ) || *r->p == '#' ) ) {
+    if ( *r->p == '#' )
+      while ( r->p < r->end && *r->p != '\n' )
+        r->p++;
+    else
+      r->p++;
+  }
+  
+  if ( r->p == r->end || (unsigned) ( *r->p - '0' ) > 9 )
+    return false;
+  long long n = 0;
+  while ( r->p < r->end && (unsigned) ( *r->p - '0' ) <= 9 ) {
+    n = n * 10 + ( *r->p++ - '0' );
+    if ( n > INT_MAX )
+      return false;
+  }
+  *value = n;
+  return true;
+}
+
+/**
+  This function reads the header of a PGM file.  For a P5 file it also
+  skips the single whitespace character in front of the pixels.
+  
+  @param r The reader, which is left at the first pixel.
+  @param h Filled in with the header.
+  @return False if the header isn't valid.
+*/
+static bool readHeader( Reader *r, Header *h )
+{
+  const char *start = r->p;
+  if ( r->end - r->p < 2 || r->p[0] != 'P' || ( r->p[1] != '2' && r->p[1] != '5' ) )
+    return false;
+  h->binary = r->p[1] == '5';
+  r->p += 2;
+  
+  if ( !readNumber( r, &h->width ) || !readNumber( r, &h->height )
+       || !readNumber( r, &h->maxValue ) )
+    return false;
+  if ( h->width <= 0 || h->height <= 0 || h->maxValue <= 0 || h->maxValue > MAX_COLOR )
+    return false;
+  
+  if ( h->binary ) {
+    if ( r->p == r->end || !isSpace( *r->p ) )
+      return false;
+    r->p++;
+    if ( (size_t) ( r->end - r->p ) / h->width < (size_t) h->height )
+      return false;
+  }
+  
+  //Checks the header is the one saveImage writes, and that the file is
+  //exactly as long as saveImage would make it
+  char header[ HEADER_SIZE ];
+  int headerLen = snprintf( header, sizeof( header ), "P%c\n%d %d\n255\n",
+                            h->binary ? '5' : '2', h->width, h->height );
+  size_t pixelLen = (size_t) h->width * h->height * ( h->binary ? 1 : PIXEL_TEXT );
+  ptrdiff_t seen = r->p - start + ( h->binary || r->p == r->end ? 0 : 1 );
+  r->exact = h->maxValue == MAX_COLOR && seen == headerLen
+    && memcmp( start, header, headerLen ) == 0
+    && (size_t) ( r->end - start ) == headerLen + pixelLen;
+  r->pixels = start + headerLen;
+  r->count = 0;
+  return true;
+}
+
+/**
+  This function reads the next row of pixels, scaling them up to 255.
+  
+  @param r The reader.
+  @param h The header of the image.
+  @param scale Table from the values in the file to pixel values.
+  @param row Filled in with the row.
+  @return False if the file doesn't have a whole row left.
+*/
+static bool readRow( Reader *r, const Header *h, const unsigned char *scale,
+                     unsigned char *row )
+{
+  if ( h->binary ) {
+    //The header already checked there are enough pixels left
+    if ( h->maxValue == MAX_COLOR ) {
+      memcpy( row, r->p, h->width );
+    } else {
+      for ( int i = 0; i < h->width; i++ ) {
+        unsigned char v = r->p[ i ];
+        if ( v > h->maxValue )
+          return false;
+        row[ i ] = scale[ v ];
+      }
+    }
+    r->p += h->width;
+    return true;
+  }
+  
+  for ( int i = 0; i < h->width; i++ ) {
+    int v;
+    if ( !readNumber( r, &v ) || v > h->maxValue )
+      return false;
+    row[ i ] = scale[ v ];
+    
+    //Every number has to end right before the space or newline at the
+    //end of its own PIXEL_TEXT characters
+    if ( r->exact ) {
+      r->exact = r->p - r->pixels == (ptrdiff_t) ( r->count * PIXEL_TEXT + PIXEL_TEXT - 1 )
+        && *r->p == ( i == h->width - 1 ? '\n' : ' ' );
+      r->count++;
+    }
+  }
+  return true;
+}
+
+/**
+  This function maps an image file and reads its header.
+  
+  @param inputFile The image file.
+  @param mf Filled in with the contents of the file, which the caller
+  frees with unmapFile() if this worked.
+  @param r Filled in with a reader at the first pixel.
+  @param h Filled in with the header.
+  @param scale Filled in with the table from the values in the file to
+  pixel values.
+  @return False if the file couldn't be read or isn't a PGM file.
+*/
+static bool openImage( FILE *inputFile, MappedFile *mf, Reader *r, Header *h,
+                       unsigned char *scale )
+{
+  if ( !mapFile( inputFile, mf ) )
+    return false;
+  r->p = mf->data;
+  r->end = mf->data + mf->len;
+  if ( !readHeader( r, h ) ) {
+    unmapFile( mf );
+    return false;
+  }
+  
+  for ( int v = 0; v <= h->maxValue; v++ )
+    scale[ v ] = ( v * MAX_COLOR + h->maxValue / 2 ) / h->maxValue;
+  return true;
+}
+
+Canvas *loadImage( FILE *inputFile, ImageFormat *format, bool *exact )
+{
+  MappedFile mf;
+  Reader r;
+  Header h;
+  unsigned char scale[ MAX_COLOR + 1 ];
+  if ( !openImage( inputFile, &mf, &r, &h, scale ) )
+    return NULL;
+  
+  Canvas *image = makeCanvas( h.width, h.height );
+  for ( int k = 0; image && k < h.height; k++ ) {
+    if ( !readRow( &r, &h, scale, canvasRow( image, k ) ) ) {
+      freeCanvas( image );
+      image = NULL;
+    }
+  }
+  
+  if ( format )
+    *format = h.binary ? FORMAT_P5 : FORMAT_P2;
+  if ( exact )
+    *exact = r.exact;
+  unmapFile( &mf );
+  return image;
+}
+
+/**
+  This function tells if every pixel in one tile of a band of rows is
+  the same color.
+  
+  @param band The rows, one after another.
+  @param width The width of each row.
+  @param t The part of the band the tile covers, with y0 at the band's
+  first row.
+  @return True if the tile is all one color.
+*/
+static bool tileSolid( const unsigned char *band, int width, const Rect *t )
+{
+  unsigned char color = band[ t->x0 ];
+  for ( int k = 0; k < t->y1 - t->y0; k++ ) {
+    const unsigned char *row = band + (size_t) k * width;
+    for ( int i = t->x0; i < t->x1; i++ )
+      if ( row[ i ] != color )
+        return false;
+  }
+  return true;
+}
+
+TiledCanvas *loadTiledImage( FILE *inputFile )
+{
+  MappedFile mf;
+  Reader r;
+  Header h;
+  unsigned char scale[ MAX_COLOR + 1 ];
+  if ( !openImage( inputFile, &mf, &r, &h, scale ) )
+    return NULL;
+  
+  TiledCanvas *image = makeTiledCanvas( h.width, h.height, MAX_COLOR );
+  unsigned char *band = (unsigned char *) malloc( (size_t) h.width * TILE_SIZE );
+  bool ok = image != NULL && band != NULL;
+  
+  for ( int b = 0; ok && b < image->rows; b++ ) {
+    int y0 = b * TILE_SIZE;
+    int rows = h.height - y0 < TILE_SIZE ? h.height - y0 : TILE_SIZE;
+    for ( int k = 0; ok && k < rows; k++ )
+      ok = readRow( &r, &h, scale, band + (size_t) k * h.width );
+    
+    //Copies the band into the tiles that aren't all one color
+    for ( int c = 0; ok && c < image->cols; c++ ) {
+      int t = b * image->cols + c;
+      Rect tile;
+      tileRect( image, t, &tile );
+      Rect inBand = { tile.x0, 0, tile.x1, rows };
+      if ( tileSolid( band, h.width, &inBand ) ) {
+        setTileColor( image, t, band[ tile.x0 ] );
+        continue;
+      }
+      
+      Canvas view;
+      ok = openTile( image, t, &view );
+      for ( int k = 0; ok && k < rows; k++ )
+        memcpy( canvasRow( &view, y0 + k ), band + (size_t) k * h.width + tile.x0,
+                tile.x1 - tile.x0 );
+    }
+  }
+  
+  free( band );
+  unmapFile( &mf );
+  if ( !ok && image ) {
+    freeTiledCanvas( image );
+    image = NULL;
+  }
+  return image;
+}
@@ -0,0 +1,42 @@
+/**
+  @file load.h
+  @author Jesse Liddle (jaliddl2)
+
+  Reads an existing PGM image, plain P2 or raw P5, so a script can be
+  drawn on top of it instead of on a blank canvas.
+*/
+#ifndef _LOAD_H_
+#define _LOAD_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "canvas.h"
+#include "image.h"
+
+/**
+  This function loads an image onto a new canvas.  The file is mapped,
+  so the pixels of a P5 image are copied straight out of the mapping.
+  Images with a maximum value under 255 are scaled up to 255.
+  
+  @param inputFile The image file.
+  @param format If not NULL, filled in with the format of the file.
+  @param exact If not NULL, filled in with true if the file is laid
+  out exactly as saveImage would write it, so it can be updated in
+  place with updateImage().
+  @return The new canvas, or NULL if the file isn't a valid 8-bit PGM
+  image.  The caller frees it with freeCanvas().
+*/
+Canvas *loadImage( FILE *inputFile, ImageFormat *format, bool *exact );
+
+/**
+  This function loads an image onto a new tiled canvas.  The image is
+  read a row of tiles at a time, and tiles that are all one color stay
+  solid.
+  
+  @param inputFile The image file.
+  @return The new canvas, or NULL if the file isn't a valid 8-bit PGM
+  image.  The caller frees it with freeTiledCanvas().
+*/
+TiledCanvas *loadTiledImage( FILE *inputFile );
+
+#endif
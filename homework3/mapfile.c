@@ -0,0 +1,78 @@
+/**
+  @file mapfile.c
+  @author Jesse Liddle (jaliddl2)
+
+  This file maps or reads whole files.
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include "mapfile.h"
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//Size of the first buffer used for a file that can't be mapped
+#define READ_BLOCK 65536
+
+bool mapFile( FILE *file, MappedFile *mf )
+{
+  int fd = fileno( file );
+  struct stat st;
+  mf->data = "";
+  mf->len = 0;
+  mf->map = NULL;
+  mf->buffer = NULL;
+  
+  //Regular files are mapped and used in place
+  if ( fstat( fd, &st ) == 0 && S_ISREG( st.st_mode ) ) {
+    if ( st.st_size == 0 )
+      return true;
+    //The mapping is private but writable, so the pages of a compiled
+    //script can be changed in place without touching the file
+    void *map = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+    if ( map != MAP_FAILED ) {
+      posix_madvise( map, st.st_size, POSIX_MADV_SEQUENTIAL );
+      mf->map = map;
+      mf->data = (const char *) map;
+      mf->len = st.st_size;
+      return true;
+    }
+  }
+  
+  //Anything else is read into memory first
+  size_t cap = READ_BLOCK;
+  char *text = (char *) malloc( cap );
+  if ( text == NULL )
+    return false;
+  size_t got;
+  while ( ( got = fread( text + mf->len, 1, cap - mf->len, file ) ) > 0 ) {
+    mf->len += got;
+    if ( mf->len == cap ) {
+      cap *= 2;
+      char *bigger = (char *) realloc( text, cap );
+      if ( bigger == NULL ) {
+        free( text );
+        mf->len = 0;
+        return false;
+      }
+      text = bigger;
+    }
+  }
+  if ( ferror( file ) ) {
+    free( text );
+    mf->len = 0;
+    return false;
+  }
+  mf->buffer = text;
+  mf->data = text;
+  return true;
+}
+
+void unmapFile( MappedFile *mf )
+{
+  if ( mf->map )
+    munmap( mf->map, mf->len );
+  free( mf->buffer );
+  mf->map = NULL;
+  mf->buffer = NULL;
+}
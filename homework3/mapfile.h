@@ -0,0 +1,46 @@
+/**
+  @file mapfile.h
+  @author Jesse Liddle (jaliddl2)
+
+  Gets the whole contents of an open file in memory.  Regular files are
+  mapped, so nothing is copied, and anything else, like a pipe, is read
+  into a buffer.
+*/
+#ifndef _MAPFILE_H_
+#define _MAPFILE_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+//The contents of a file
+typedef struct {
+  //The bytes of the file
+  const char *data;
+  size_t len;
+  
+  //The mapping, or the buffer the file was read into
+  void *map;
+  char *buffer;
+} MappedFile;
+
+/**
+  This function gets the contents of a file, starting from where it is
+  now for a file that can't be mapped.
+  
+  @param file The file to read.
+  @param mf Filled in with the contents.  It must be freed with
+  unmapFile().
+  @return False if the file couldn't be read or there wasn't enough
+  memory for it.
+*/
+bool mapFile( FILE *file, MappedFile *mf );
+
+/**
+  This function frees the contents of a file.
+  
+  @param mf The contents to free.
+*/
+void unmapFile( MappedFile *mf );
+
+#endif
@@ -0,0 +1,573 @@
+/**
+  @file png.c
+  @author Jesse Liddle (jaliddl2)
+
+  This file writes PNG images.  The image data is compressed as a single
+  deflate stream using the fixed Huffman codes, with a hash chain match
+  finder over the last 32K of data.  The fixed codes aren't as small as
+  codes built for the data, but they cost nothing to set up, and the
+  flat images drawings make are mostly long matches anyway.
+*/
+#include "png.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+//Size of the deflate window
+#define WINDOW ( 1 << 15 )
+
+//Size of the buffer that holds the window and the data after it
+#define HISTORY ( 3 * WINDOW )
+
+//Shortest and longest deflate matches
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+
+//Bits in a match finder hash
+#define HASH_BITS 15
+
+//Number of earlier places with the same hash that are tried
+#define MAX_CHAIN 16
+
+//Longest match whose every place is added to the match finder
+#define MAX_INSERT 16
+
+//Size of the IDAT chunks written
+#define CHUNK_SIZE ( 1 << 16 )
+
+//Number of PNG row filters
+#define FILTERS 5
+
+//Symbol that ends a deflate block
+#define END_BLOCK 256
+
+struct PngWriterTag {
+  FILE *out;
+  int width;
+  int height;
+  
+  //The row before the current one, and a filtered row for each filter,
+  //each starting with its filter type byte
+  unsigned char *prev;
+  unsigned char *filtered[ FILTERS ];
+  
+  //Data waiting to be compressed, after the window of data already
+  //compressed.  Everything before pos has been compressed.
+  unsigned char *history;
+  size_t len;
+  size_t pos;
+  
+  //Match finder tables.  head holds the latest place plus one for each
+  //hash, and prev links each place to the one before with its hash.
+  uint32_t *head;
+  uint32_t *chain;
+  
+  //Bits waiting to be written, lowest first
+  uint64_t bits;
+  int bitCount;
+  
+  //Compressed bytes waiting for the next IDAT chunk
+  unsigned char *chunk;
+  size_t chunkLen;
+  
+  //Checksum of the uncompressed data
+  uint32_t adler;
+};
+
+//Huffman codes for literal and length symbols and for distances, with
+//their bits reversed so they can be written lowest bit first
+static uint16_t litCode[ 288 ];
+static unsigned char litBits[ 288 ];
+static uint16_t distCode[ 30 ];
+
+//Length symbol and extra bits for each match length
+static uint16_t lengthSym[ MAX_MATCH + 1 ];
+static unsigned char lengthExtraBits[ MAX_MATCH + 1 ];
+static uint16_t lengthExtra[ MAX_MATCH + 1 ];
+
+//Smallest distance of each distance symbol, and its extra bits
+static const uint16_t distBase[ 30 ] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+  513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const unsigned char distExtraBits[ 30 ] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7,
+  8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+//Table for the PNG CRC
+static uint32_t crcTable[ 256 ];
+
+//Makes sure the tables above are filled in once
+static pthread_once_t tablesOnce = PTHREAD_ONCE_INIT;
+
+/**
+  This function reverses the lowest bits of a number.
+  
+  @param code The number.
+  @param n How many of its bits to reverse.
+  @return The reversed bits.
+*/
+static uint16_t reverseBits( unsigned code, int n )
+{
+  unsigned r = 0;
+  for ( int i = 0; i < n; i++ )
+    r |= ( ( code >> i ) & 1 ) << ( n - 1 - i );
+  return r;
+}
+
+/**
+  This function fills in the code and checksum tables.
+*/
+static void makeTables( void )
+{
+  for ( int s = 0; s < 288; s++ ) {
+    if ( s < 144 ) {
+      litCode[ s ] = reverseBits( 0x30 + s, 8 );
+      litBits[ s ] = 8;
+    } else if ( s < 256 ) {
+      litCode[ s ] = reverseBits( 0x190 + s - 144, 9 );
+      litBits[ s ] = 9;
+    } else if ( s < 280 ) {
+      litCode[ s ] = reverseBits( s - 256, 7 );
+      litBits[ s ] = 7;
+    } else {
+      litCode[ s ] = reverseBits( 0xc0 + s - 280, 8 );
+      litBits[ s ] = 8;
+    }
+  }
+  for ( int d = 0; d < 30; d++ )
+    distCode[ d ] = reverseBits( d, 5 );
+  
+  //Length symbols 257 to 284 cover four lengths per extra bit, and
+  //symbol 285 is just 258
+  int sym = 257;
+  int base = MIN_MATCH;
+  for ( int extra = 0; extra <= 5; extra++ ) {
+    for ( int k = 0; k < ( extra == 0 ? 8 : 4 ); k++, sym++ ) {
+      for ( int i = 0; i < ( 1 << extra ) && base + i < MAX_MATCH; i++ ) {
+        lengthSym[ base + i ] = sym;
+        lengthExtraBits[ base + i ] = extra;
+        lengthExtra[ base + i ] = i;
+      }
+      base += 1 << extra;
+    }
+  }
+  lengthSym[ MAX_MATCH ] = 285;
+  lengthExtraBits[ MAX_MATCH ] = 0;
+  lengthExtra[ MAX_MATCH ] = 0;
+  
+  for ( uint32_t n = 0; n < 256; n++ ) {
+    uint32_t c = n;
+    for ( int k = 0; k < 8; k++ )
+      c = c & 1 ? 0xedb88320u ^ ( c >> 1 ) : c >> 1;
+    crcTable[ n ] = c;
+  }
+}
+
+/**
+  This function updates a PNG CRC with more bytes.
+  
+  @param crc The CRC so far, starting from 0xffffffff.
+  @param buf The bytes.
+  @param len Number of bytes.
+  @return The new CRC.
+*/
+static uint32_t updateCrc( uint32_t crc, const unsigned char *buf, size_t len )
+{
+  for ( size_t i = 0; i < len; i++ )
+    crc = crcTable[ ( crc ^ buf[ i ] ) & 0xff ] ^ ( crc >> 8 );
+  return crc;
+}
+
+/**
+  This function updates an Adler-32 checksum with more bytes.  The sums
+  are only reduced every few thousand bytes, which is as long as they
+  can go without overflowing.
+  
+  @param adler The checksum so far, starting from 1.
+  @param buf The bytes.
+  @param len Number of bytes.
+  @return The new checksum.
+*/
+static uint32_t updateAdler( uint32_t adler, const unsigned char *buf, size_t len )
+{
+  uint32_t a = adler & 0xffff;
+  uint32_t b = adler >> 16;
+  while ( len > 0 ) {
+    size_t n = len < 5552 ? len : 5552;
+    len -= n;
+    while ( n-- > 0 ) {
+      a += *buf++;
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  return b << 16 | a;
+}
+
+/**
+  This function stores a number as four bytes, most significant first.
+  
+  @param p Where to store it.
+  @param v The number.
+*/
+static void putWord( unsigned char *p, uint32_t v )
+{
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+/**
+  This function writes one PNG chunk.
+  
+  @param out The file.
+  @param type The four letter type of the chunk.
+  @param data The data of the chunk.
+  @param len Number of bytes of data.
+*/
+static void writeChunk( FILE *out, const char *type, const unsigned char *data, size_t len )
+{
+  unsigned char word[ 4 ];
+  putWord( word, len );
+  fwrite( word, 1, 4, out );
+  fwrite( type, 1, 4, out );
+  fwrite( data, 1, len, out );
+  uint32_t crc = updateCrc( 0xffffffffu, (const unsigned char *) type, 4 );
+  crc = updateCrc( crc, data, len );
+  putWord( word, crc ^ 0xffffffffu );
+  fwrite( word, 1, 4, out );
+}
+
+/**
+  This function adds bits to the compressed data, writing out an IDAT
+  chunk whenever enough bytes are ready.
+  
+  @param png The writer.
+  @param value The bits, lowest first.
+  @param n Number of bits, at most 32.
+*/
+static inline void putBits( PngWriter *png, uint32_t value, int n )
+{
+  png->bits |= (uint64_t) value << png->bitCount;
+  png->bitCount += n;
+  while ( png->bitCount >= 8 ) {
+    png->chunk[ png->chunkLen++ ] = png->bits;
+    png->bits >>= 8;
+    png->bitCount -= 8;
+    if ( png->chunkLen == CHUNK_SIZE ) {
+      writeChunk( png->out, "IDAT", png->chunk, png->chunkLen );
+      png->chunkLen = 0;
+    }
+  }
+}
+
+/**
+  This function computes the match finder hash of three bytes.
+  
+  @param p The bytes.
+  @return The hash.
+*/
+static inline uint32_t hash3( const unsigned char *p )
+{
+  uint32_t v = (uint32_t) p[0] << 16 | (uint32_t) p[1] << 8 | p[2];
+  return ( v * 2654435761u ) >> ( 32 - HASH_BITS );
+}
+
+/**
+  This function adds one place in the history to the match finder.
+  
+  @param png The writer.
+  @param i The place, which must have two more bytes after it.
+*/
+static inline void insertHash( PngWriter *png, size_t i )
+{
+  uint32_t h = hash3( png->history + i );
+  png->chain[ i % WINDOW ] = png->head[ h ];
+  png->head[ h ] = i + 1;
+}
+
+/**
+  This function counts how many bytes two places in the history have in
+  common, a word at a time.
+  
+  @param a The earlier place.
+  @param b The later place.
+  @param maxLen Most bytes to compare.
+  @return The number of matching bytes, up to maxLen.
+*/
+static inline int matchLength( const unsigned char *a, const unsigned char *b, int maxLen )
+{
+  int n = 0;
+  while ( n + 8 <= maxLen ) {
+    uint64_t x, y;
+    memcpy( &x, a + n, 8 );
+    memcpy( &y, b + n, 8 );
+    if ( x != y ) {
+#if defined( __GNUC__ ) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      return n + ( __builtin_ctzll( x ^ y ) >> 3 );
+#else
+      break;
+#endif
+    }
+    n += 8;
+  }
+  while ( n < maxLen && a[ n ] == b[ n ] )
+    n++;
+  return n;
+}
+
+/**
+  This function finds the longest earlier copy of the data at pos.
+  
+  @param png The writer.
+  @param limit End of the data that can be matched.
+  @param dist Filled in with how far back the match is.
+  @return The length of the match, or 0 if there isn't one.
+*/
+static int findMatch( PngWriter *png, size_t limit, int *dist )
+{
+  const unsigned char *h = png->history;
+  size_t pos = png->pos;
+  int maxLen = limit - pos < MAX_MATCH ? limit - pos : MAX_MATCH;
+  int best = 0;
+  if ( maxLen < MIN_MATCH )
+    return 0;
+  
+  uint32_t cand = png->head[ hash3( h + pos ) ];
+  for ( int tries = 0; cand != 0 && tries < MAX_CHAIN; tries++ ) {
+    size_t c = cand - 1;
+    if ( c >= pos || pos - c >= WINDOW )
+      break;
+    if ( h[ c + best ] == h[ pos + best ] ) {
+      int n = matchLength( h + c, h + pos, maxLen );
+      if ( n > best ) {
+        best = n;
+        *dist = pos - c;
+        if ( n == maxLen )
+          break;
+      }
+    }
+    cand = png->chain[ c % WINDOW ];
+  }
+  return best >= MIN_MATCH ? best : 0;
+}
+
+/**
+  This function compresses the history up to a given place.
+  
+  @param png The writer.
+  @param end Where to stop.  Matches can use data past it, up to len.
+*/
+static void compress( PngWriter *png, size_t end )
+{
+  while ( png->pos < end ) {
+    int dist = 0;
+    int n = findMatch( png, png->len, &dist );
+    if ( n == 0 ) {
+      unsigned char c = png->history[ png->pos ];
+      putBits( png, litCode[ c ], litBits[ c ] );
+      n = 1;
+    } else {
+      int sym = lengthSym[ n ];
+      putBits( png, litCode[ sym ], litBits[ sym ] );
+      putBits( png, lengthExtra[ n ], lengthExtraBits[ n ] );
+      int d = 29;
+      while ( distBase[ d ] > dist )
+        d--;
+      putBits( png, distCode[ d ], 5 );
+      putBits( png, dist - distBase[ d ], distExtraBits[ d ] );
+    }
+    
+    //Every place in a short match goes in the match finder, but only
+    //the ends of a long one, which is plenty for the long runs of the
+    //same bytes that make long matches in the first place
+    for ( int i = 0; i < n; i++, png->pos++ )
+      if ( ( n <= MAX_INSERT || i < MIN_MATCH || i >= n - MIN_MATCH )
+           && png->pos + MIN_MATCH <= png->len )
+        insertHash( png, png->pos );
+  }
+}
+
+/**
+  This function slides the history down by one window, dropping data
+  too old to match and fixing up the match finder tables.
+  
+  @param png The writer.
+*/
+static void slide( PngWriter *png )
+{
+  memmove( png->history, png->history + WINDOW, png->len - WINDOW );
+  png->len -= WINDOW;
+  png->pos -= WINDOW;
+  for ( int i = 0; i < ( 1 << HASH_BITS ); i++ )
+    png->head[ i ] = png->head[ i ] > WINDOW ? png->head[ i ] - WINDOW : 0;
+  for ( int i = 0; i < WINDOW; i++ )
+    png->chain[ i ] = png->chain[ i ] > WINDOW ? png->chain[ i ] - WINDOW : 0;
+}
+
+/**
+  This function adds bytes to the data being compressed, compressing
+  everything except the last bit, which might still match later data.
+  
+  @param png The writer.
+  @param data The bytes.
+  @param len Number of bytes.
+*/
+static void deflateData( PngWriter *png, const unsigned char *data, size_t len )
+{
+  png->adler = updateAdler( png->adler, data, len );
+  while ( len > 0 ) {
+    size_t n = len < WINDOW ? len : WINDOW;
+    if ( png->len + n > HISTORY )
+      slide( png );
+    memcpy( png->history + png->len, data, n );
+    png->len += n;
+    data += n;
+    len -= n;
+    if ( png->len > MAX_MATCH )
+      compress( png, png->len - MAX_MATCH );
+  }
+}
+
+PngWriter *startPng( FILE *outputFile, int width, int height )
+{
+  pthread_once( &tablesOnce, makeTables );
+  
+  PngWriter *png = (PngWriter *) calloc( 1, sizeof( PngWriter ) );
+  if ( png == NULL )
+    return NULL;
+  png->out = outputFile;
+  png->width = width;
+  png->height = height;
+  png->prev = (unsigned char *) calloc( width + 1, 1 );
+  bool ok = png->prev != NULL;
+  for ( int f = 0; f < FILTERS; f++ )
+    ok = ( png->filtered[ f ] = (unsigned char *) malloc( width + 1 ) ) && ok;
+  png->history = (unsigned char *) malloc( HISTORY );
+  png->head = (uint32_t *) calloc( 1 << HASH_BITS, sizeof( uint32_t ) );
+  png->chain = (uint32_t *) calloc( WINDOW, sizeof( uint32_t ) );
+  png->chunk = (unsigned char *) malloc( CHUNK_SIZE );
+  png->adler = 1;
+  if ( !ok || !png->history || !png->head || !png->chain || !png->chunk ) {
+    png->height = 0;
+    finishPng( png );
+    return NULL;
+  }
+  
+  static const unsigned char signature[ 8 ] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+  fwrite( signature, 1, sizeof( signature ), outputFile );
+  
+  //Eight bit greyscale, no interlacing
+  unsigned char header[ 13 ] = { 0 };
+  putWord( header, width );
+  putWord( header + 4, height );
+  header[ 8 ] = 8;
+  writeChunk( outputFile, "IHDR", header, sizeof( header ) );
+  
+  //The zlib header, then the header of one fixed Huffman block that
+  //isn't the last
+  png->chunk[ png->chunkLen++ ] = 0x78;
+  png->chunk[ png->chunkLen++ ] = 0x01;
+  putBits( png, 0x2, 3 );
+  return png;
+}
+
+/**
+  This function predicts a pixel from its neighbors the way the Paeth
+  filter does.
+  
+  @param a The pixel to the left.
+  @param b The pixel above.
+  @param c The pixel above and to the left.
+  @return Whichever neighbor is closest to a + b - c.
+*/
+static inline int paeth( int a, int b, int c )
+{
+  int pa = abs( b - c );
+  int pb = abs( a - c );
+  int pc = abs( a + b - 2 * c );
+  int bc = pb <= pc ? b : c;
+  return pa <= pb && pa <= pc ? a : bc;
+}
+
+void writePngRow( PngWriter *png, const unsigned char *row )
+{
+  const unsigned char *up = png->prev + 1;
+  int w = png->width;
+  unsigned long cost[ FILTERS ] = { 0 };
+  
+  //A row that repeats the one above is all zeros with the Up filter,
+  //which can't be beaten
+  if ( memcmp( row, up, w ) == 0 ) {
+    memset( png->filtered[ 2 ], 0, w + 1 );
+    png->filtered[ 2 ][ 0 ] = 2;
+    deflateData( png, png->filtered[ 2 ], w + 1 );
+    return;
+  }
+  
+  //Filters the row every way and scores each one by the sum of its
+  //bytes taken as signed values, the usual quick guess at which one
+  //will compress best.  Each filter gets its own simple loop, which the
+  //compiler can turn into vector code
+  unsigned char *out[ FILTERS ];
+  for ( int f = 0; f < FILTERS; f++ ) {
+    png->filtered[ f ][ 0 ] = f;
+    out[ f ] = png->filtered[ f ] + 1;
+  }
+  memcpy( out[ 0 ], row, w );
+  out[ 1 ][ 0 ] = row[ 0 ];
+  out[ 3 ][ 0 ] = row[ 0 ] - ( up[ 0 ] >> 1 );
+  out[ 4 ][ 0 ] = row[ 0 ] - up[ 0 ];
+  for ( int i = 0; i < w; i++ )
+    out[ 2 ][ i ] = row[ i ] - up[ i ];
+  for ( int i = 1; i < w; i++ ) {
+    out[ 1 ][ i ] = row[ i ] - row[ i - 1 ];
+    out[ 3 ][ i ] = row[ i ] - ( ( row[ i - 1 ] + up[ i ] ) >> 1 );
+    out[ 4 ][ i ] = row[ i ] - paeth( row[ i - 1 ], up[ i ], up[ i - 1 ] );
+  }
+  for ( int f = 0; f < FILTERS; f++ )
+    for ( int i = 0; i < w; i++ )
+      cost[ f ] += abs( (signed char) out[ f ][ i ] );
+  
+  int best = 0;
+  for ( int f = 1; f < FILTERS; f++ )
+    if ( cost[ f ] < cost[ best ] )
+      best = f;
+  deflateData( png, png->filtered[ best ], w + 1 );
+  memcpy( png->prev + 1, row, w );
+}
+
+void finishPng( PngWriter *png )
+{
+  if ( png->height > 0 ) {
+    //Ends the block, then adds an empty last block, since the block
+    //that was started couldn't be marked as the last one
+    compress( png, png->len );
+    putBits( png, litCode[ END_BLOCK ], litBits[ END_BLOCK ] );
+    putBits( png, 0x3, 3 );
+    putBits( png, litCode[ END_BLOCK ], litBits[ END_BLOCK ] );
+    if ( png->bitCount > 0 )
+      putBits( png, 0, 8 - png->bitCount );
+    
+    unsigned char word[ 4 ];
+    putWord( word, png->adler );
+    for ( int i = 0; i < 4; i++ )
+      putBits( png, word[ i ], 8 );
+    writeChunk( png->out, "IDAT", png->chunk, png->chunkLen );
+    writeChunk( png->out, "IEND", NULL, 0 );
+  }
+  
+  free( png->prev );
+  for ( int f = 0; f < FILTERS; f++ )
+    free( png->filtered[ f ] );
+  free( png->history );
+  free( png->head );
+  free( png->chain );
+  free( png->chunk );
+  free( png );
+}
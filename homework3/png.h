@@ -0,0 +1,49 @@
+/**
+  @file png.h
+  @author Jesse Liddle (jaliddl2)
+
+  A small greyscale PNG writer with its own deflate compressor, so no
+  outside library is needed.  Rows are handed over one at a time, and
+  compressed data is written out in IDAT chunks as it builds up.
+*/
+#ifndef _PNG_H_
+#define _PNG_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/**
+  Short typename for a PNG that is being written.  Its representation is
+  private to png.c.
+*/
+typedef struct PngWriterTag PngWriter;
+
+/**
+  This function starts writing a PNG, writing its signature and header.
+  
+  @param outputFile The file to write to.
+  @param width The width of the image.
+  @param height The height of the image.
+  @return The new writer, or NULL if there isn't enough memory.
+*/
+PngWriter *startPng( FILE *outputFile, int width, int height );
+
+/**
+  This function adds the next row of the image.  Each row is filtered
+  with whichever PNG filter makes it smallest by a quick estimate, then
+  compressed.
+  
+  @param png The writer.
+  @param row The pixels of the row.
+*/
+void writePngRow( PngWriter *png, const unsigned char *row );
+
+/**
+  This function finishes the image after its last row, writing the rest
+  of the compressed data and the end chunk, and frees the writer.
+  
+  @param png The writer.
+*/
+void finishPng( PngWriter *png );
+
+#endif
@@ -0,0 +1,474 @@
+/**
+  @file render.c
+  @author Jesse Liddle (jaliddl2)
+
+  This file draws scripts, either in one pass or split into tiles that
+  are shared out between threads.
+*/
+#include "render.h"
+#include "image.h"
+#include "cull.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+//The commands binned into every tile of a canvas
+typedef struct {
+  //Size of the canvas in tiles
+  int cols;
+  int rows;
+  
+  //Commands of tile t are list[ start[ t ] ] up to list[ start[ t + 1 ] ],
+  //in script order
+  size_t *start;
+  int *list;
+} Bins;
+
+//State shared by the drawing threads
+typedef struct {
+  //The canvas being drawn on, which is a plain canvas, a tiled one or
+  //a color one
+  Canvas *image;
+  TiledCanvas *tiled;
+  RgbCanvas *rgb;
+  
+  const Script *script;
+  const Bins *bins;
+  
+  //Next tile that hasn't been taken by a thread yet
+  int next;
+  pthread_mutex_t lock;
+  
+  //Set if a tile couldn't get memory for its pixels
+  bool failed;
+} Work;
+
+/**
+  This function draws the shape of one command in the given color
+  instead of its own, which is how one plane of a color canvas is drawn.
+  
+  @param image The canvas to draw on.
+  @param clip The part of the canvas to draw in.
+  @param script The script the command is from.
+  @param cmd The command to draw.
+  @param color The grey level to draw with.
+  @param visited If not NULL, the pixels looked at are added to it.
+  @return The number of pixels set.
+*/
+static long long drawShape( Canvas *image, const Rect *clip, const Script *script,
+                            const Command *cmd, unsigned char color, long long *visited )
+{
+  const int *a = cmd->args;
+  if ( cmd->op == OP_LINE )
+    return drawLineClipped( image, clip, a[0], a[1], a[2], a[3], color, visited );
+  else if ( cmd->op == OP_CIRCLE )
+    return drawCircleClipped( image, clip, a[0], a[1], a[2], color, visited );
+  else if ( cmd->op == OP_RECT )
+    return drawRectClipped( image, clip, a[0], a[1], a[2], a[3], color, visited );
+  else
+    return drawPolygonClipped( image, clip, script->points + 2 * a[0], a[1], color,
+                               visited );
+}
+
+long long drawCommand( Canvas *image, const Rect *clip, const Script *script,
+                       const Command *cmd, long long *visited )
+{
+  return drawShape( image, clip, script, cmd, greyLevel( commandColor( cmd ) ), visited );
+}
+
+/**
+  This function draws a list of commands on every plane of a color
+  canvas.  Each plane gets all of the commands before the next one is
+  started, so only one plane's part of the canvas is being written at a
+  time.
+  
+  @param image The canvas to draw on.
+  @param clip The part of the canvas to draw in.
+  @param script The script the commands are from.
+  @param list Indexes of the commands to draw, in order, or NULL for
+  the whole script.
+  @param count Number of commands to draw.
+*/
+static void drawPlanes( RgbCanvas *image, const Rect *clip, const Script *script,
+                        const int *list, size_t count )
+{
+  for ( int p = 0; p < RGB_PLANES; p++ ) {
+    for ( size_t j = 0; j < count; j++ ) {
+      const Command *cmd = script->cmds + ( list ? list[ j ] : (int) j );
+      drawShape( image->planes[ p ], clip, script, cmd,
+                 colorChannel( commandColor( cmd ), p ), NULL );
+    }
+  }
+}
+
+/**
+  This function finds the box around every pixel a command could draw,
+  before it is clipped to the canvas.
+  
+  @param script The script the command is from.
+  @param cmd The command.
+  @param x0 Filled in with the left side of the box.
+  @param y0 Filled in with the top of the box.
+  @param x1 Filled in with the right side of the box, which is included.
+  @param y1 Filled in with the bottom of the box, which is included.
+  @return False if the command can't draw anything at all.
+*/
+static bool commandExtent( const Script *script, const Command *cmd,
+                           long long *x0, long long *y0, long long *x1, long long *y1 )
+{
+  const int *a = cmd->args;
+  if ( cmd->op == OP_LINE ) {
+    *x0 = a[0] < a[2] ? a[0] : a[2];
+    *x1 = a[0] < a[2] ? a[2] : a[0];
+    *y0 = a[1] < a[3] ? a[1] : a[3];
+    *y1 = a[1] < a[3] ? a[3] : a[1];
+  } else if ( cmd->op == OP_RECT || cmd->op == OP_POLYGON ) {
+    //Both fill the pixels with centers inside them, so the right and
+    //bottom sides of the corners' box aren't included
+    const int *p = cmd->op == OP_RECT ? a : script->points + 2 * a[0];
+    int corners = cmd->op == OP_RECT ? 2 : a[1];
+    *x0 = *x1 = p[0];
+    *y0 = *y1 = p[1];
+    for ( int i = 1; i < corners; i++ ) {
+      long long x = p[ 2 * i ];
+      long long y = p[ 2 * i + 1 ];
+      *x0 = x < *x0 ? x : *x0;
+      *x1 = x > *x1 ? x : *x1;
+      *y0 = y < *y0 ? y : *y0;
+      *y1 = y > *y1 ? y : *y1;
+    }
+    if ( *x0 == *x1 || *y0 == *y1 )
+      return false;
+    ( *x1 )--;
+    ( *y1 )--;
+  } else {
+    if ( a[2] <= 0 )
+      return false;
+    *x0 = (long long) a[0] - a[2];
+    *x1 = (long long) a[0] + a[2];
+    *y0 = (long long) a[1] - a[2];
+    *y1 = (long long) a[1] + a[2];
+  }
+  return true;
+}
+
+bool commandBounds( int width, int height, const Script *script,
+                    const Command *cmd, Rect *box )
+{
+  long long x0, y0, x1, y1;//Bounding box, inclusive
+  if ( !commandExtent( script, cmd, &x0, &y0, &x1, &y1 ) )
+    return false;
+  
+  if ( x1 < 0 || y1 < 0 || x0 >= width || y0 >= height )
+    return false;
+  box->x0 = x0 < 0 ? 0 : x0;
+  box->y0 = y0 < 0 ? 0 : y0;
+  box->x1 = x1 > width - 1 ? width : x1 + 1;
+  box->y1 = y1 > height - 1 ? height : y1 + 1;
+  return true;
+}
+
+bool commandClipped( int width, int height, const Script *script,
+                     const Command *cmd )
+{
+  long long x0, y0, x1, y1;
+  return commandExtent( script, cmd, &x0, &y0, &x1, &y1 )
+    && ( x0 < 0 || y0 < 0 || x1 >= width || y1 >= height );
+}
+
+/**
+  This function divides rounding down, for any signs.  The number being
+  divided is 128 bits, since it can be the product of two line lengths.
+  
+  @param a The number to divide.
+  @param b The number to divide by, which isn't zero.
+  @return a / b rounded down, which must fit in a long long.
+*/
+static long long floorDiv( __int128 a, long long b )
+{
+  long long q = a / b;
+  return ( a % b != 0 && ( a < 0 ) != ( b < 0 ) ) ? q - 1 : q;
+}
+
+/**
+  This function finds the tiles a command could draw in within one row
+  of tiles.  For a slanted line this is just the tiles around the part
+  of the line that crosses the row, found from the x values of the line
+  half a pixel above and below the row, plus one pixel of slack for
+  rounding.  Anything else gets every tile under its bounding box.
+  
+  @param cmd The command.
+  @param box The bounding box of the command, from commandBounds().
+  @param band The row of tiles.
+  @param c0 Filled in with the first column of tiles.
+  @param c1 Filled in with one past the last column of tiles.
+*/
+static void bandColumns( const Command *cmd, const Rect *box, int band,
+                         int *c0, int *c1 )
+{
+  long long left = box->x0;
+  long long right = box->x1 - 1;
+  const int *a = cmd->args;
+  if ( cmd->op == OP_LINE && a[0] != a[2] && a[1] != a[3] ) {
+    long long dx = (long long) a[2] - a[0];
+    long long dy = (long long) a[3] - a[1];
+    long long ymin = a[1] < a[3] ? a[1] : a[3];
+    long long ymax = a[1] < a[3] ? a[3] : a[1];
+    long long ya = (long long) band * TILE_SIZE - 1;
+    long long yb = (long long) ( band + 1 ) * TILE_SIZE;
+    if ( ya < ymin )
+      ya = ymin;
+    if ( yb > ymax )
+      yb = ymax;
+    long long xa = a[0] + floorDiv( (__int128) ( ya - a[1] ) * dx, dy );
+    long long xb = a[0] + floorDiv( (__int128) ( yb - a[1] ) * dx, dy );
+    if ( xa > xb ) {
+      long long t = xa;
+      xa = xb;
+      xb = t;
+    }
+    if ( xa - 1 > left )
+      left = xa - 1;
+    if ( xb + 1 < right )
+      right = xb + 1;
+  }
+  
+  *c0 = left / TILE_SIZE;
+  *c1 = left <= right ? right / TILE_SIZE + 1 : *c0;
+}
+
+/**
+  This function bins the commands of a script into tiles.  It counts the
+  commands in each tile first, so the lists can all go in one array.
+  
+  @param width The width of the canvas being drawn on.
+  @param height The height of the canvas being drawn on.
+  @param script The commands to bin.
+  @param bins The bins to fill in.  They are freed with freeBins().
+*/
+static void makeBins( int width, int height, const Script *script, Bins *bins )
+{
+  bins->cols = ( width - 1 ) / TILE_SIZE + 1;
+  bins->rows = ( height - 1 ) / TILE_SIZE + 1;
+  int count = bins->cols * bins->rows;
+  bins->start = (size_t *) calloc( count + 1, sizeof( size_t ) );
+  
+  //Counts the commands in every tile
+  Rect box;
+  int c0, c1;
+  for ( int i = 0; i < script->count; i++ ) {
+    const Command *cmd = script->cmds + i;
+    if ( commandBounds( width, height, script, cmd, &box ) ) {
+      for ( int r = box.y0 / TILE_SIZE; r <= ( box.y1 - 1 ) / TILE_SIZE; r++ ) {
+        bandColumns( cmd, &box, r, &c0, &c1 );
+        for ( int c = c0; c < c1; c++ )
+          bins->start[ r * bins->cols + c + 1 ]++;
+      }
+    }
+  }
+  
+  for ( int k = 0; k < count; k++ )
+    bins->start[ k + 1 ] += bins->start[ k ];
+  bins->list = (int *) malloc( ( bins->start[ count ] + 1 ) * sizeof( int ) );
+  
+  //Fills in the lists, using fill[ k ] as the end of tile k's list so far
+  size_t *fill = (size_t *) malloc( count * sizeof( size_t ) );
+  for ( int k = 0; k < count; k++ )
+    fill[ k ] = bins->start[ k ];
+  for ( int i = 0; i < script->count; i++ ) {
+    const Command *cmd = script->cmds + i;
+    if ( commandBounds( width, height, script, cmd, &box ) ) {
+      for ( int r = box.y0 / TILE_SIZE; r <= ( box.y1 - 1 ) / TILE_SIZE; r++ ) {
+        bandColumns( cmd, &box, r, &c0, &c1 );
+        for ( int c = c0; c < c1; c++ )
+          bins->list[ fill[ r * bins->cols + c ]++ ] = i;
+      }
+    }
+  }
+  free( fill );
+}
+
+/**
+  This function frees the lists made by makeBins().
+  
+  @param bins The bins to free.
+*/
+static void freeBins( Bins *bins )
+{
+  free( bins->start );
+  free( bins->list );
+}
+
+/**
+  This function draws the commands of one tile of a tiled canvas.  If a
+  command paints the whole tile, the tile is just made solid in its
+  color and only the commands after it are drawn, so the tile only gets
+  pixels of its own when something really draws part of it.
+  
+  @param work The shared state.
+  @param k The tile to draw.
+  @return False if the tile couldn't get memory for its pixels.
+*/
+static bool drawTiledTile( Work *work, int k )
+{
+  const Bins *bins = work->bins;
+  const Command *cmds = work->script->cmds;
+  size_t first = bins->start[ k ];
+  size_t end = bins->start[ k + 1 ];
+  Rect clip;
+  tileRect( work->tiled, k, &clip );
+  
+  for ( size_t j = end; j > first; j-- ) {
+    const Command *cmd = cmds + bins->list[ j - 1 ];
+    if ( commandCovers( cmd, &clip ) ) {
+      setTileColor( work->tiled, k, greyLevel( commandColor( cmd ) ) );
+      first = j;
+      break;
+    }
+  }
+  
+  if ( first == end )
+    return true;
+  
+  Canvas view;
+  if ( !openTile( work->tiled, k, &view ) )
+    return false;
+  for ( size_t j = first; j < end; j++ )
+    drawCommand( &view, &clip, work->script, cmds + bins->list[ j ], NULL );
+  return true;
+}
+
+/**
+  This function is run by each drawing thread.  It keeps taking the next
+  tile and drawing all of its commands until there are none left.
+  
+  @param arg The shared Work.
+  @return Always NULL.
+*/
+static void *drawTiles( void *arg )
+{
+  Work *work = (Work *) arg;
+  const Bins *bins = work->bins;
+  int count = bins->cols * bins->rows;
+  
+  while ( true ) {
+    pthread_mutex_lock( &work->lock );
+    int k = work->next++;
+    pthread_mutex_unlock( &work->lock );
+    if ( k >= count )
+      break;
+    
+    if ( work->tiled ) {
+      if ( !drawTiledTile( work, k ) ) {
+        pthread_mutex_lock( &work->lock );
+        work->failed = true;
+        pthread_mutex_unlock( &work->lock );
+      }
+      continue;
+    }
+    
+    int width = work->rgb ? work->rgb->width : work->image->width;
+    int height = work->rgb ? work->rgb->height : work->image->height;
+    Rect clip;
+    clip.x0 = k % bins->cols * TILE_SIZE;
+    clip.y0 = k / bins->cols * TILE_SIZE;
+    clip.x1 = clip.x0 + TILE_SIZE < width ? clip.x0 + TILE_SIZE : width;
+    clip.y1 = clip.y0 + TILE_SIZE < height ? clip.y0 + TILE_SIZE : height;
+    
+    if ( work->rgb ) {
+      drawPlanes( work->rgb, &clip, work->script, bins->list + bins->start[ k ],
+                  bins->start[ k + 1 ] - bins->start[ k ] );
+      continue;
+    }
+    
+    for ( size_t j = bins->start[ k ]; j < bins->start[ k + 1 ]; j++ )
+      drawCommand( work->image, &clip, work->script,
+                   work->script->cmds + bins->list[ j ], NULL );
+  }
+  
+  return NULL;
+}
+
+/**
+  This function bins a script and draws its tiles with a pool of threads.
+  
+  @param work The shared state, with the canvas and script filled in.
+  @param width The width of the canvas.
+  @param height The height of the canvas.
+  @param threads Number of threads to draw with, at least one.
+*/
+static void drawBinned( Work *work, int width, int height, int threads )
+{
+  Bins bins;
+  makeBins( width, height, work->script, &bins );
+  work->bins = &bins;
+  work->next = 0;
+  work->failed = false;
+  pthread_mutex_init( &work->lock, NULL );
+  
+  //The calling thread draws tiles too, so only threads - 1 are started
+  pthread_t *ids = (pthread_t *) malloc( threads * sizeof( pthread_t ) );
+  int started = 0;
+  while ( started < threads - 1
+          && pthread_create( ids + started, NULL, drawTiles, work ) == 0 )
+    started++;
+  drawTiles( work );
+  for ( int i = 0; i < started; i++ )
+    pthread_join( ids[ i ], NULL );
+  
+  free( ids );
+  pthread_mutex_destroy( &work->lock );
+  freeBins( &bins );
+}
+
+void renderScript( Canvas *image, const Script *script, int threads )
+{
+  //Rows are marked as changed up front, from the bounding boxes, so the
+  //drawing threads never have to share the flags
+  Rect box;
+  if ( image->dirty )
+    for ( int i = 0; i < script->count; i++ )
+      if ( commandBounds( image->width, image->height, script,
+                          script->cmds + i, &box ) )
+        markRows( image, box.y0, box.y1 );
+  
+  if ( threads <= 1 ) {
+    Rect all = { 0, 0, image->width, image->height };
+    for ( int i = 0; i < script->count; i++ )
+      drawCommand( image, &all, script, script->cmds + i, NULL );
+    return;
+  }
+  
+  Work work;
+  work.image = image;
+  work.tiled = NULL;
+  work.rgb = NULL;
+  work.script = script;
+  drawBinned( &work, image->width, image->height, threads );
+}
+
+bool renderTiled( TiledCanvas *image, const Script *script, int threads )
+{
+  Work work;
+  work.image = NULL;
+  work.tiled = image;
+  work.rgb = NULL;
+  work.script = script;
+  drawBinned( &work, image->width, image->height, threads < 1 ? 1 : threads );
+  return !work.failed;
+}
+
+void renderRgb( RgbCanvas *image, const Script *script, int threads )
+{
+  if ( threads <= 1 ) {
+    Rect all = { 0, 0, image->width, image->height };
+    drawPlanes( image, &all, script, NULL, script->count );
+    return;
+  }
+  
+  Work work;
+  work.image = NULL;
+  work.tiled = NULL;
+  work.rgb = image;
+  work.script = script;
+  drawBinned( &work, image->width, image->height, threads );
+}
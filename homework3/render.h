@@ -0,0 +1,97 @@
+/**
+  @file render.h
+  @author Jesse Liddle (jaliddl2)
+
+  Draws a whole script on a canvas.  With more than one thread, the
+  canvas is split into square tiles and every command is binned into the
+  tiles its bounding box touches.  Each thread then takes whole tiles and
+  draws their commands in script order, clipped to the tile, so no two
+  threads ever write the same pixel and the picture comes out exactly
+  the same as drawing the script in one pass.
+*/
+#ifndef _RENDER_H_
+#define _RENDER_H_
+
+#include "canvas.h"
+#include "script.h"
+
+/**
+  This function finds the part of the canvas a command could draw in.
+  
+  @param width The width of the canvas being drawn on.
+  @param height The height of the canvas being drawn on.
+  @param script The script the command is from, which holds the corners
+  of polygons.
+  @param cmd The command.
+  @param box Filled in with a rectangle holding every pixel the command
+  could draw.
+  @return False if the command can't touch the canvas at all.
+*/
+bool commandBounds( int width, int height, const Script *script,
+                    const Command *cmd, Rect *box );
+
+/**
+  This function tells if a command reaches past the edges of the canvas,
+  so some of what it would draw is clipped away.
+  
+  @param width The width of the canvas being drawn on.
+  @param height The height of the canvas being drawn on.
+  @param script The script the command is from.
+  @param cmd The command.
+  @return True if the command's bounding box isn't all on the canvas.
+*/
+bool commandClipped( int width, int height, const Script *script,
+                     const Command *cmd );
+
+/**
+  This function draws one command, clipped to part of the canvas.  An
+  RGB color is drawn as its grey level.
+  
+  @param image The canvas to draw on.
+  @param clip The part of the canvas to draw in.
+  @param script The script the command is from.
+  @param cmd The command to draw.
+  @param visited If not NULL, the number of pixels the drawing code
+  looked at is added to it: every pixel set, plus one for each row or
+  step it worked out that set nothing.
+  @return The number of pixels set.
+*/
+long long drawCommand( Canvas *image, const Rect *clip, const Script *script,
+                       const Command *cmd, long long *visited );
+
+/**
+  This function draws every command of a script on a canvas.
+  
+  @param image The canvas to draw on.
+  @param script The commands to draw.
+  @param threads Number of threads to draw with.  One or less draws the
+  script in a single pass on the calling thread.
+*/
+void renderScript( Canvas *image, const Script *script, int threads );
+
+/**
+  This function draws every command of a script on a tiled canvas.  The
+  commands are always binned into tiles, even with one thread, so tiles
+  nothing draws on stay solid and never get pixels of their own.
+  
+  @param image The tiled canvas to draw on.
+  @param script The commands to draw.
+  @param threads Number of threads to draw with.
+  @return False if there wasn't enough memory for the tiles.
+*/
+bool renderTiled( TiledCanvas *image, const Script *script, int threads );
+
+/**
+  This function draws every command of a script on a color canvas, one
+  plane at a time.  Each plane is drawn exactly the way a greyscale
+  canvas is, with the command's value in that channel as its color, so
+  a grey level ends up the same in all three.
+  
+  @param image The color canvas to draw on.
+  @param script The commands to draw.
+  @param threads Number of threads to draw with.  One or less draws the
+  script in a single pass on the calling thread.
+*/
+void renderRgb( RgbCanvas *image, const Script *script, int threads );
+
+#endif
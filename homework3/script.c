@@ -0,0 +1,372 @@
+/**
+  @file script.c
+  @author Jesse Liddle (jaliddl2)
+
+  This file reads drawing scripts into memory.  The whole script is
+  mapped, or read in one go if it can't be, and then split into commands
+  by a small hand-written tokenizer instead of scanf.  Compiled scripts
+  skip the tokenizer and are used straight from the mapping.
+*/
+#include "script.h"
+#include "mapfile.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+
+//First number of commands a script has room for
+#define INITIAL_CAPACITY 64
+
+//Largest grey level a command can use
+#define MAX_COLOR 255
+
+//Hex digits in an RGB color
+#define RGB_DIGITS 6
+
+//Guess at the number of characters in a typical command
+#define AVERAGE_COMMAND 16
+
+//Start of a compiled script.  No text script can start with it, since
+//D isn't a command.
+#define COMPILED_MAGIC "DRAWBIN\n"
+
+//Version of the compiled layout, changed whenever Command is
+#define COMPILED_VERSION 1
+
+//Written in the byte order of the machine that compiled the script
+#define BYTE_ORDER_MARK 0x01020304u
+
+//Header at the start of a compiled script, followed by count commands
+//and then pointCount numbers for the corners of the polygons
+typedef struct {
+  char magic[ 8 ];
+  uint32_t version;
+  
+  //Size of each command, which also catches a different size of int
+  uint32_t recordSize;
+  uint32_t byteOrder;
+  uint32_t count;
+  uint32_t pointCount;
+  uint32_t reserved;
+} CompiledHeader;
+
+/**
+  Adds a command to the end of a script, making more room if needed.
+  
+  @param script The script to add to.
+  @return The new command, for the caller to fill in.
+*/
+static Command *addCommand( Script *script )
+{
+  if ( script->count == script->capacity ) {
+    script->capacity = script->capacity ? script->capacity * 2 : INITIAL_CAPACITY;
+    script->cmds = (Command *) realloc( script->cmds,
+        script->capacity * sizeof( Command ) );
+  }
+  return script->cmds + script->count++;
+}
+
+//Characters isspace() accepts in the C locale
+static const bool isSpace[ 256 ] = {
+  [ ' ' ] = true, [ '\t' ] = true, [ '\n' ] = true,
+  [ '\v' ] = true, [ '\f' ] = true, [ '\r' ] = true
+};
+
+/**
+  This function skips the whitespace at the start of some text, the
+  same characters isspace() accepts, counting the lines it skips.
+  
+  @param p The start of the text.
+  @param end The end of the text.
+  @param line The line number, which goes up at every newline.
+  @return The first character that isn't whitespace, or end.
+*/
+static inline const char *skipSpace( const char *p, const char *end, int *line )
+{
+  while ( p < end && isSpace[ (unsigned char) *p ] )
+    *line += *p++ == '\n';
+  return p;
+}
+
+/**
+  This function reads a number the way the %d conversion of scanf does,
+  after skipping any whitespace in front of it.  Numbers too big for an
+  int are clamped to the nearest one that fits.
+  
+  @param p Points to where to start reading, and is moved past the number.
+  @param end The end of the text.
+  @param line The line number, counted up past the whitespace.
+  @param value Filled in with the number.
+  @return False if there isn't a number there.
+*/
+static inline bool readNumber( const char **p, const char *end, int *line, int *value )
+{
+  const char *q = skipSpace( *p, end, line );
+  bool negative = false;
+  if ( q < end && ( *q == '-' || *q == '+' ) )
+    negative = *q++ == '-';
+  if ( q == end || (unsigned) ( *q - '0' ) > 9 )
+    return false;
+  
+  //Digits past the first ten can only make the number bigger, so they
+  //are skipped once it is already too big for an int
+  long long n = *q++ - '0';
+  unsigned d;
+  while ( q < end && ( d = *q - '0' ) <= 9 ) {
+    n = n * 10 + d;
+    q++;
+    if ( n > INT_MAX ) {
+      while ( q < end && (unsigned) ( *q - '0' ) <= 9 )
+        q++;
+      break;
+    }
+  }
+  
+  if ( negative )
+    n = -n;
+  *value = n > INT_MAX ? INT_MAX : n < INT_MIN ? INT_MIN : n;
+  *p = q;
+  return true;
+}
+
+/**
+  This function reads a color, either a grey level or # and six hex
+  digits, after skipping any whitespace in front of it.
+  
+  @param p Points to where to start reading, and is moved past the color.
+  @param end The end of the text.
+  @param line The line number, counted up past the whitespace.
+  @param value Filled in with the color.
+  @return False if there isn't a valid color there.
+*/
+static inline bool readColor( const char **p, const char *end, int *line, int *value )
+{
+  //Grey levels are tried first, since most colors are one
+  int start = *line;
+  if ( readNumber( p, end, line, value ) )
+    return *value >= 0 && *value <= MAX_COLOR;
+  
+  *line = start;
+  const char *q = skipSpace( *p, end, line );
+  if ( end - q <= RGB_DIGITS || *q != '#' )
+    return false;
+  int rgb = 0;
+  for ( int i = 1; i <= RGB_DIGITS; i++ ) {
+    int c = q[ i ];
+    int d = (unsigned) ( c - '0' ) <= 9 ? c - '0'
+      : (unsigned) ( ( c | 0x20 ) - 'a' ) <= 5 ? ( c | 0x20 ) - 'a' + 10 : -1;
+    if ( d < 0 )
+      return false;
+    rgb = rgb * 16 + d;
+  }
+  *value = RGB_COLOR + rgb;
+  *p = q + RGB_DIGITS + 1;
+  return true;
+}
+
+/**
+  This function reads the corners of a polygon into the script's points,
+  making more room if needed.
+  
+  @param p Points to where to start reading, and is moved past the corners.
+  @param end The end of the text.
+  @param line The line number, counted up past the whitespace.
+  @param script The script to add the corners to.
+  @param n Number of corners to read.
+  @return False if a corner is missing or too far from zero.
+*/
+static bool readCorners( const char **p, const char *end, int *line,
+                         Script *script, int n )
+{
+  //Every corner needs at least four characters, so a count bigger than
+  //the rest of the text allows can't be right
+  if ( n > ( end - *p ) / 4 || n > ( INT_MAX - script->pointCount ) / 2 )
+    return false;
+  
+  if ( script->pointCount + 2 * n > script->pointCapacity ) {
+    int cap = script->pointCapacity ? script->pointCapacity : INITIAL_CAPACITY;
+    while ( cap < script->pointCount + 2 * n )
+      cap = cap > INT_MAX / 2 ? INT_MAX : cap * 2;
+    script->points = (int *) realloc( script->points, cap * sizeof( int ) );
+    script->pointCapacity = cap;
+  }
+  
+  int *v = script->points + script->pointCount;
+  for ( int i = 0; i < 2 * n; i++ )
+    if ( !readNumber( p, end, line, v + i ) || v[ i ] < -MAX_POLYGON_COORD
+         || v[ i ] > MAX_POLYGON_COORD )
+      return false;
+  script->pointCount += 2 * n;
+  return true;
+}
+
+bool parseScript( const char *text, size_t len, Script *script )
+{
+  const char *p = text;
+  const char *end = text + len;
+  int line = 1;//Line the tokenizer is on
+  
+  //Starts with room for a guess at the number of commands, so big
+  //scripts don't copy the array over and over while it grows
+  script->count = 0;
+  script->points = NULL;
+  script->pointCount = 0;
+  script->pointCapacity = 0;
+  script->compiled = false;
+  script->capacity = len / AVERAGE_COMMAND + INITIAL_CAPACITY;
+  script->cmds = (Command *) malloc( script->capacity * sizeof( Command ) );
+  
+  while ( ( p = skipSpace( p, end, &line ) ) < end ) {
+    char type = *p++;//Type of object being drawn
+    Command *cmd = addCommand( script );
+    int *a = cmd->args;
+    cmd->line = line;
+    int n;//Numbers the command takes
+    if ( type == 'l' || type == 'L' ) {
+      cmd->op = OP_LINE;
+      n = 5;
+    } else if ( type == 'c' || type == 'C' ) {
+      cmd->op = OP_CIRCLE;
+      n = 4;
+    } else if ( type == 'r' || type == 'R' ) {
+      cmd->op = OP_RECT;
+      n = 5;
+    } else if ( type == 'p' || type == 'P' ) {
+      //The corners go in the points, leaving just the color to read
+      cmd->op = OP_POLYGON;
+      a[ 0 ] = script->pointCount / 2;
+      a[ 2 ] = a[ 3 ] = 0;
+      if ( !readNumber( &p, end, &line, a + 1 ) || a[ 1 ] < 3
+           || !readCorners( &p, end, &line, script, a[ 1 ] )
+           || !readColor( &p, end, &line, a + 4 ) )
+        return false;
+      continue;
+    } else {
+      //Error if line does not start with l, c, r or p
+      return false;
+    }
+    
+    for ( int i = 0; i < n - 1; i++ )
+      if ( !readNumber( &p, end, &line, a + i ) )
+        return false;
+    if ( !readColor( &p, end, &line, a + n - 1 ) )
+      return false;
+  }
+  
+  return true;
+}
+
+/**
+  This function checks a compiled script and points the script at the
+  commands and corners in it.  Nothing is copied, but every command is
+  checked the way the tokenizer would check it, so the drawing code can
+  trust them.
+  
+  @param data The contents of the file, starting with the header.
+  @param len Number of bytes in the file.
+  @param script The script to fill in.
+  @return False if the header doesn't match or a command isn't valid.
+*/
+static bool useCompiled( const char *data, size_t len, Script *script )
+{
+  CompiledHeader head;
+  if ( len < sizeof( head ) )
+    return false;
+  memcpy( &head, data, sizeof( head ) );
+  if ( head.version != COMPILED_VERSION || head.recordSize != sizeof( Command )
+       || head.byteOrder != BYTE_ORDER_MARK || head.count > INT_MAX
+       || head.pointCount > INT_MAX || head.pointCount % 2 != 0
+       || len != sizeof( head ) + (size_t) head.count * sizeof( Command )
+       + (size_t) head.pointCount * sizeof( int ) )
+    return false;
+  
+  Command *cmds = (Command *) ( data + sizeof( head ) );
+  int *points = (int *) ( cmds + head.count );
+  for ( uint32_t i = 0; i < head.pointCount; i++ )
+    if ( points[ i ] < -MAX_POLYGON_COORD || points[ i ] > MAX_POLYGON_COORD )
+      return false;
+  
+  for ( uint32_t i = 0; i < head.count; i++ ) {
+    const Command *cmd = cmds + i;
+    int op = cmd->op;
+    if ( op != OP_LINE && op != OP_CIRCLE && op != OP_RECT && op != OP_POLYGON )
+      return false;
+    if ( !validColor( commandColor( cmd ) ) )
+      return false;
+    if ( op == OP_POLYGON && ( cmd->args[ 0 ] < 0 || cmd->args[ 1 ] < 3
+         || (long long) cmd->args[ 0 ] + cmd->args[ 1 ] > head.pointCount / 2 ) )
+      return false;
+  }
+  
+  script->cmds = cmds;
+  script->count = head.count;
+  script->capacity = head.count;
+  script->points = points;
+  script->pointCount = head.pointCount;
+  script->pointCapacity = head.pointCount;
+  return true;
+}
+
+bool readScript( FILE *inputFile, Script *script )
+{
+  script->cmds = NULL;
+  script->count = 0;
+  script->capacity = 0;
+  script->points = NULL;
+  script->pointCount = 0;
+  script->pointCapacity = 0;
+  script->compiled = false;
+  
+  MappedFile mf;
+  if ( !mapFile( inputFile, &mf ) ) {
+    unmapFile( &mf );
+    return false;
+  }
+  
+  //A compiled script keeps its file, since the commands are in it
+  size_t magic = sizeof( COMPILED_MAGIC ) - 1;
+  if ( mf.len >= magic && memcmp( mf.data, COMPILED_MAGIC, magic ) == 0 ) {
+    script->compiled = true;
+    script->file = mf;
+    return useCompiled( mf.data, mf.len, script );
+  }
+  
+  bool valid = parseScript( mf.data, mf.len, script );
+  unmapFile( &mf );
+  return valid;
+}
+
+bool writeCompiled( FILE *outputFile, const Script *script )
+{
+  CompiledHeader head;
+  memset( &head, 0, sizeof( head ) );
+  memcpy( head.magic, COMPILED_MAGIC, sizeof( head.magic ) );
+  head.version = COMPILED_VERSION;
+  head.recordSize = sizeof( Command );
+  head.byteOrder = BYTE_ORDER_MARK;
+  head.count = script->count;
+  head.pointCount = script->pointCount;
+  
+  return fwrite( &head, sizeof( head ), 1, outputFile ) == 1
+    && fwrite( script->cmds, sizeof( Command ), script->count, outputFile )
+    == (size_t) script->count
+    && fwrite( script->points, sizeof( int ), script->pointCount, outputFile )
+    == (size_t) script->pointCount;
+}
+
+void freeScript( Script *script )
+{
+  if ( script->compiled ) {
+    unmapFile( &script->file );
+  } else {
+    free( script->cmds );
+    free( script->points );
+  }
+  script->cmds = NULL;
+  script->count = 0;
+  script->capacity = 0;
+  script->points = NULL;
+  script->pointCount = 0;
+  script->pointCapacity = 0;
+  script->compiled = false;
+}
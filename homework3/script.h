@@ -0,0 +1,174 @@
+/**
+  @file script.h
+  @author Jesse Liddle (jaliddl2)
+
+  A drawing script read into memory as a list of commands, so it can be
+  read completely before any drawing starts and then drawn in any order
+  the renderer likes.  A script can also be compiled into a binary file
+  that holds the commands exactly as they are laid out in memory, which
+  is mapped and used in place instead of being parsed.
+*/
+#ifndef _SCRIPT_H_
+#define _SCRIPT_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "mapfile.h"
+
+//Most numbers any command takes
+#define MAX_ARGS 5
+
+//Kinds of commands
+#define OP_LINE 'l'
+#define OP_CIRCLE 'c'
+#define OP_RECT 'r'
+#define OP_POLYGON 'p'
+
+//Largest distance from zero a polygon's corners can be, which keeps the
+//edge math of the polygon filler inside a long long
+#define MAX_POLYGON_COORD ( 1 << 28 )
+
+//Colors at or above this are RGB colors, stored as RGB_COLOR plus the
+//0xrrggbb value they are written as, and colors below it are grey levels
+#define RGB_COLOR 0x1000000
+
+//One command from a script.  A line has x1 y1 x2 y2 color as its
+//arguments, a circle has cx cy radius color and a filled rectangle has
+//the two opposite corners x1 y1 x2 y2 and then its color.  A filled
+//polygon has the index of its first corner in the script's points, its
+//number of corners, two unused numbers and its color.
+typedef struct {
+  int op;
+  int args[ MAX_ARGS ];
+  
+  //Line of the script the command starts on, counting from one
+  int line;
+} Command;
+
+//All the commands in a script, in order
+typedef struct {
+  Command *cmds;
+  int count;
+  int capacity;
+  
+  //Corners of every polygon in the script, as x y pairs, so corner i
+  //is points[ 2 * i ] and points[ 2 * i + 1 ]
+  int *points;
+  int pointCount;
+  int pointCapacity;
+  
+  //The compiled file the commands and points are in, when the script
+  //came from one instead of being parsed
+  bool compiled;
+  MappedFile file;
+} Script;
+
+/**
+  This function gives the color a command draws with.
+  
+  @param cmd The command.
+  @return Its color.
+*/
+static inline int commandColor( const Command *cmd )
+{
+  return cmd->op == OP_CIRCLE ? cmd->args[ 3 ] : cmd->args[ 4 ];
+}
+
+/**
+  This function tells if a color is one a command can use, either a
+  grey level from 0 to 255 or an RGB color.
+  
+  @param color The color.
+  @return True if it's valid.
+*/
+static inline bool validColor( int color )
+{
+  return ( color >= 0 && color <= 255 )
+    || ( color >= RGB_COLOR && color <= RGB_COLOR + 0xFFFFFF );
+}
+
+/**
+  This function gives the grey level a color is drawn as on a greyscale
+  canvas.  RGB colors are weighted the way luma is, rounded.
+  
+  @param color A valid color.
+  @return Its grey level.
+*/
+static inline unsigned char greyLevel( int color )
+{
+  if ( color < RGB_COLOR )
+    return color;
+  int r = color >> 16 & 0xFF;
+  int g = color >> 8 & 0xFF;
+  int b = color & 0xFF;
+  return ( 299 * r + 587 * g + 114 * b + 500 ) / 1000;
+}
+
+/**
+  This function gives one channel of a color.  A grey level is the same
+  in all three.
+  
+  @param color A valid color.
+  @param channel 0 for red, 1 for green or 2 for blue.
+  @return The value of the channel.
+*/
+static inline unsigned char colorChannel( int color, int channel )
+{
+  if ( color < RGB_COLOR )
+    return color;
+  return color >> ( 16 - 8 * channel ) & 0xFF;
+}
+
+/**
+  This function reads a whole script from a file.  Each command is a
+  letter, l, c, r or p in either case, followed by its numbers.  Every
+  color is either a grey level between 0 and 255 or an RGB color written
+  as # and six hex digits, like #ff8000.  A polygon is p, the number of
+  corners, which must be at least 3, then an x y pair for each corner
+  and then the color.  Its corners must be within MAX_POLYGON_COORD of
+  zero.  A compiled script, from writeCompiled(), is recognized by the
+  header at its start and used without parsing, as long as the header
+  matches this program and the commands are valid.
+  
+  @param inputFile The file to read.
+  @param script The script to fill in.  It must be freed with
+  freeScript() whether or not reading worked.
+  @return True if the script was valid.
+*/
+bool readScript( FILE *inputFile, Script *script );
+
+/**
+  This function parses a script that is already in memory, accepting
+  exactly the text scripts readScript() does.  It doesn't draw anything, so
+  it can run while an earlier script is still being drawn.
+  
+  @param text The text of the script, which doesn't need to end in a
+  null character.
+  @param len Number of characters in the text.
+  @param script The script to fill in.  It must be freed with
+  freeScript() whether or not parsing worked.
+  @return True if the script was valid.
+*/
+bool parseScript( const char *text, size_t len, Script *script );
+
+/**
+  This function writes a script as a compiled binary file: a header
+  followed by the commands as fixed-size records and then the corners of
+  the polygons.  Numbers are written in the byte order of this machine,
+  and a machine that doesn't match rejects the file.
+  
+  @param outputFile The file to write.
+  @param script The script to write.
+  @return False if the file couldn't be written.
+*/
+bool writeCompiled( FILE *outputFile, const Script *script );
+
+/**
+  This function frees the commands in a script.
+  
+  @param script The script to free.
+*/
+void freeScript( Script *script );
+
+#endif
@@ -0,0 +1,167 @@
+/**
+  @file stats.c
+  @author Jesse Liddle (jaliddl2)
+
+  This file draws scripts one command at a time while keeping track of
+  what each command costs.
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include "stats.h"
+#include "render.h"
+#include <stdlib.h>
+#include <time.h>
+
+//Number of slowest commands listed in the summary
+#define SLOWEST 5
+
+//Number of kinds of commands
+#define OPS 4
+
+//Kinds of commands, in the order they are listed in the summary
+static const int ops[ OPS ] = { OP_LINE, OP_CIRCLE, OP_RECT, OP_POLYGON };
+
+/**
+  This function returns the name of a kind of command.
+
+  @param op The kind of command.
+  @return Its name.
+*/
+static const char *opName( int op )
+{
+  return op == OP_LINE ? "line" : op == OP_CIRCLE ? "circle"
+    : op == OP_RECT ? "rect" : "polygon";
+}
+
+/**
+  This function returns the current value of the monotonic clock in
+  seconds.
+
+  @return The time in seconds.
+*/
+static double now()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+CommandStats *renderStats( Canvas *image, const Script *script )
+{
+  CommandStats *stats = (CommandStats *) malloc( ( script->count + 1 ) *
+                                                 sizeof( CommandStats ) );
+  if ( stats == NULL )
+    return NULL;
+
+  Rect all = { 0, 0, image->width, image->height };
+  for ( int i = 0; i < script->count; i++ ) {
+    const Command *cmd = script->cmds + i;
+    CommandStats *s = stats + i;
+    Rect box;
+    s->line = cmd->line;
+    s->op = cmd->op;
+    s->rejected = !commandBounds( image->width, image->height, script, cmd, &box );
+    s->clipped = !s->rejected && commandClipped( image->width, image->height,
+                                                 script, cmd );
+    s->visited = 0;
+    if ( image->dirty && !s->rejected )
+      markRows( image, box.y0, box.y1 );
+
+    //Rejected commands are still drawn, so their time shows what the
+    //drawing code spends finding out there's nothing to do
+    double t = now();
+    s->written = drawCommand( image, &all, script, cmd, &s->visited );
+    s->seconds = now() - t;
+  }
+
+  return stats;
+}
+
+/**
+  This function orders commands from slowest to fastest, for qsort.
+*/
+static int compareTime( const void *a, const void *b )
+{
+  double ta = ( *(const CommandStats **) a )->seconds;
+  double tb = ( *(const CommandStats **) b )->seconds;
+  return ( ta < tb ) - ( ta > tb );
+}
+
+void printStats( FILE *out, const Canvas *image, const CommandStats *stats, int count )
+{
+  long long n[ OPS + 1 ] = { 0 };
+  long long rejected[ OPS + 1 ] = { 0 };
+  long long clipped[ OPS + 1 ] = { 0 };
+  long long visited[ OPS + 1 ] = { 0 };
+  long long written[ OPS + 1 ] = { 0 };
+  double seconds[ OPS + 1 ] = { 0 };
+
+  //Totals for each kind of command
+  for ( int i = 0; i < count; i++ ) {
+    const CommandStats *s = stats + i;
+    int k = 0;
+    while ( k < OPS - 1 && ops[ k ] != s->op )
+      k++;
+    n[ k ]++;
+    rejected[ k ] += s->rejected;
+    clipped[ k ] += s->clipped;
+    visited[ k ] += s->visited;
+    written[ k ] += s->written;
+    seconds[ k ] += s->seconds;
+  }
+  
+  //And the grand total after them
+  for ( int k = 0; k < OPS; k++ ) {
+    n[ OPS ] += n[ k ];
+    rejected[ OPS ] += rejected[ k ];
+    clipped[ OPS ] += clipped[ k ];
+    visited[ OPS ] += visited[ k ];
+    written[ OPS ] += written[ k ];
+    seconds[ OPS ] += seconds[ k ];
+  }
+
+  fprintf( out, "%-8s %9s %9s %9s %14s %14s %7s %10s %6s %9s\n", "kind", "commands",
+           "rejected", "clipped", "visited", "written", "hit%", "ms", "time",
+           "ns/pixel" );
+  double total = seconds[ OPS ] > 0 ? seconds[ OPS ] : 1;
+  for ( int k = 0; k <= OPS; k++ ) {
+    if ( n[ k ] == 0 && k < OPS )
+      continue;
+    fprintf( out, "%-8s %9lld %9lld %9lld %14lld %14lld %6.1f%% %10.3f %5.1f%% %9.2f\n",
+             k < OPS ? opName( ops[ k ] ) : "total", n[ k ], rejected[ k ],
+             clipped[ k ], visited[ k ], written[ k ],
+             visited[ k ] ? 100.0 * written[ k ] / visited[ k ] : 0.0,
+             seconds[ k ] * 1e3, 100 * seconds[ k ] / total,
+             written[ k ] ? seconds[ k ] * 1e9 / written[ k ] : 0.0 );
+  }
+
+  double pixels = (double) image->width * image->height;
+  fprintf( out, "Canvas painted %.2f times over\n", written[ OPS ] / pixels );
+
+  //The slowest commands, by line
+  const CommandStats **order = (const CommandStats **) malloc( ( count + 1 ) *
+                                                               sizeof( CommandStats * ) );
+  if ( order == NULL )
+    return;
+  for ( int i = 0; i < count; i++ )
+    order[ i ] = stats + i;
+  qsort( order, count, sizeof( CommandStats * ), compareTime );
+  for ( int i = 0; i < count && i < SLOWEST; i++ )
+    fprintf( out, "Slow: line %d %s, %.3f ms, %lld pixels written of %lld visited%s%s\n",
+             order[ i ]->line, opName( order[ i ]->op ), order[ i ]->seconds * 1e3,
+             order[ i ]->written, order[ i ]->visited,
+             order[ i ]->clipped ? ", clipped" : "",
+             order[ i ]->rejected ? ", rejected" : "" );
+  free( order );
+}
+
+bool writeStatsCsv( FILE *out, const CommandStats *stats, int count )
+{
+  fprintf( out, "line,kind,visited,written,ns,rejected,clipped\n" );
+  for ( int i = 0; i < count; i++ ) {
+    const CommandStats *s = stats + i;
+    fprintf( out, "%d,%s,%lld,%lld,%.0f,%d,%d\n", s->line, opName( s->op ),
+             s->visited, s->written, s->seconds * 1e9, s->rejected, s->clipped );
+  }
+  return !ferror( out );
+}
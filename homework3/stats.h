@@ -0,0 +1,76 @@
+/**
+  @file stats.h
+  @author Jesse Liddle (jaliddl2)
+
+  Instrumented drawing, for finding out what makes a script slow.  Each
+  command is drawn on its own and timed, and the pixels it sets are
+  counted, so commands that are mostly off the canvas or that paint over
+  the same pixels again and again stand out.
+*/
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "canvas.h"
+#include "script.h"
+
+//What drawing one command cost
+typedef struct {
+  //Line of the script and kind of the command
+  int line;
+  int op;
+
+  //Pixels the drawing code looked at: the ones it set, plus one for
+  //each row or step it worked out that set nothing
+  long long visited;
+
+  //Pixels the command set, including ones it or others paint over
+  long long written;
+
+  //Time spent drawing the command
+  double seconds;
+
+  //Whether the command can't touch the canvas at all, or reaches past
+  //its edges
+  bool rejected;
+  bool clipped;
+} CommandStats;
+
+/**
+  This function draws every command of a script on a canvas in one pass,
+  the same as renderScript() with one thread, while recording what each
+  command cost.
+
+  @param image The canvas to draw on.
+  @param script The commands to draw.
+  @return The statistics for each command, in script order, which the
+  caller must free, or NULL if there wasn't enough memory.
+*/
+CommandStats *renderStats( Canvas *image, const Script *script );
+
+/**
+  This function prints a summary of the statistics: totals for each kind
+  of command, how many times over the canvas was painted and the
+  commands that took the longest.  The hit% column is the share of the
+  visited pixels that were written, so the rest is work the drawing
+  code spent on rows that turned out to be empty.
+
+  @param out The file to print to.
+  @param image The canvas the script was drawn on.
+  @param stats The statistics from renderStats().
+  @param count Number of commands.
+*/
+void printStats( FILE *out, const Canvas *image, const CommandStats *stats, int count );
+
+/**
+  This function writes the statistics as CSV, one row for each command.
+
+  @param out The file to write to.
+  @param stats The statistics from renderStats().
+  @param count Number of commands.
+  @return False if the file couldn't be written.
+*/
+bool writeStatsCsv( FILE *out, const CommandStats *stats, int count );
+
+#endif
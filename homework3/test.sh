@@ -14,13 +14,14 @@ fi
 runtest() {
   TEST_NO=$1
   EX_STATUS=$2
+  OPTIONS=$3
 
   rm -f output.pgm stderr.txt stdout.txt
   # Handle the last test case as a special case.  This is kind
   # of ugly.
   if [ $TEST_NO -ne 11 ]
   then
-      ./drawing input_$TEST_NO.txt output.pgm > stdout.txt 2> stderr.txt
+      ./drawing $OPTIONS input_$TEST_NO.txt output.pgm > stdout.txt 2> stderr.txt
   else
       ./drawing bad command-line arguments > stdout.txt 2> stderr.txt
   fi
@@ -45,7 +46,18 @@ runtest() {
 	  return 1
       fi
 
-      if [ -s stderr.txt ]
+      # Standard error should be empty, unless the test expects a
+      # report there
+      if [ -f expected_err_$TEST_NO.txt ]
+      then
+	  diff -q expected_err_$TEST_NO.txt stderr.txt >/dev/null 2>&1
+	  if [ $? -ne 0 ]
+	  then
+	      echo "**** Test $TEST_NO FAILED - didn't print exactly the right report"
+	      FAIL=1
+	      return 1
+	  fi
+      elif [ -s stderr.txt ]
       then
 	  echo "**** Test $TEST_NO FAILED - shouldn't be any output on standard err"
 	  FAIL=1
@@ -92,6 +104,194 @@ runtest() {
   return 0
 }
 
+# Function to compile a test case's script with -C and then draw the
+# compiled script, checking the image, or the error message and exit
+# status if the compiled file is cut short by the given number of bytes
+# before it is drawn.
+runcompiled() {
+  TEST_NO=$1
+  EX_STATUS=$2
+  CUT=$3
+
+  rm -f output.pgm stderr.txt stdout.txt compiled.bin
+  ./drawing -C input_$TEST_NO.txt compiled.bin > stdout.txt 2> stderr.txt
+  if [ $? -ne 0 ] || [ -s stdout.txt ] || [ -s stderr.txt ]
+  then
+      echo "**** Test $TEST_NO FAILED - couldn't compile the script"
+      FAIL=1
+      return 1
+  fi
+
+  if [ -n "$CUT" ]
+  then
+      truncate -s -$CUT compiled.bin
+  fi
+
+  ./drawing compiled.bin output.pgm > stdout.txt 2> stderr.txt
+  STATUS=$?
+  if [ $EX_STATUS -eq 0 ]
+  then
+      if [ $STATUS -ne 0 ] || [ -s stdout.txt ] || [ -s stderr.txt ]
+      then
+	  echo "**** Test $TEST_NO FAILED - couldn't draw the compiled script"
+	  FAIL=1
+	  return 1
+      fi
+
+      diff -q expected_$TEST_NO.pgm output.pgm >/dev/null 2>&1
+      if [ $? -ne 0 ]
+      then
+	  echo "**** Test $TEST_NO FAILED - output image doesn't match expected image"
+	  FAIL=1
+	  return 1
+      fi
+  else
+      if [ $STATUS -eq 0 ] || [ -s stdout.txt ]
+      then
+	  echo "**** Test $TEST_NO FAILED - drew a compiled script that was cut short"
+	  FAIL=1
+	  return 1
+      fi
+
+      diff -q expected_err_$TEST_NO.txt stderr.txt >/dev/null 2>&1
+      if [ $? -ne 0 ]
+      then
+	  echo "**** Test $TEST_NO FAILED - didn't print exactly the right error message"
+	  FAIL=1
+	  return 1
+      fi
+  fi
+
+  echo "Test $TEST_NO PASS"
+  return 0
+}
+
+# Function to draw a test case's script with -u on a copy of an
+# existing image, checking that the updated file matches the expected
+# image, which is the same script drawn in full with -i.
+runupdate() {
+  TEST_NO=$1
+  OPTIONS=$2
+  START=$3
+
+  rm -f output.pgm stderr.txt stdout.txt
+  cp $START output.pgm
+  ./drawing -u $OPTIONS input_$TEST_NO.txt output.pgm > stdout.txt 2> stderr.txt
+  if [ $? -ne 0 ] || [ -s stdout.txt ] || [ -s stderr.txt ]
+  then
+      echo "**** Test $TEST_NO FAILED - couldn't update the image"
+      FAIL=1
+      return 1
+  fi
+
+  diff -q expected_$TEST_NO.pgm output.pgm >/dev/null 2>&1
+  if [ $? -ne 0 ]
+  then
+      echo "**** Test $TEST_NO FAILED - updated image doesn't match expected image"
+      FAIL=1
+      return 1
+  fi
+
+  echo "Test $TEST_NO PASS"
+  return 0
+}
+
+# Function to run a manifest of jobs with -b.  The manifest is the test
+# case's input, and its jobs write output.pgm if they work, so the
+# image, the errors reported for the jobs that fail and the exit status
+# are all checked.
+runbatch() {
+  TEST_NO=$1
+  EX_STATUS=$2
+
+  rm -f output.pgm stderr.txt stdout.txt
+  ./drawing -b input_$TEST_NO.txt > stdout.txt 2> stderr.txt
+  STATUS=$?
+  if [ $EX_STATUS -eq 0 ] && [ $STATUS -ne 0 ] || { [ $EX_STATUS -ne 0 ] && [ $STATUS -eq 0 ]; }
+  then
+      echo "**** Test $TEST_NO FAILED - incorrect exit status. Expected: $EX_STATUS Got: $STATUS"
+      FAIL=1
+      return 1
+  fi
+
+  if [ -s stdout.txt ]
+  then
+      echo "**** Test $TEST_NO FAILED - shouldn't be any output on standard out"
+      FAIL=1
+      return 1
+  fi
+
+  diff -q expected_err_$TEST_NO.txt stderr.txt >/dev/null 2>&1
+  if [ $? -ne 0 ]
+  then
+      echo "**** Test $TEST_NO FAILED - didn't print exactly the right error messages"
+      FAIL=1
+      return 1
+  fi
+
+  if [ -f expected_$TEST_NO.pgm ]
+  then
+      diff -q expected_$TEST_NO.pgm output.pgm >/dev/null 2>&1
+      if [ $? -ne 0 ]
+      then
+	  echo "**** Test $TEST_NO FAILED - output image doesn't match expected image"
+	  FAIL=1
+	  return 1
+      fi
+  fi
+
+  echo "Test $TEST_NO PASS"
+  return 0
+}
+
+# Function to draw a test case's script with -S and -c, checking the
+# image and the shape of the statistics.  Times change from run to run,
+# so the CSV file is checked for its header, one row for each command
+# and the right columns in every row, and the summary for its header.
+runstats() {
+  TEST_NO=$1
+
+  rm -f output.pgm stderr.txt stdout.txt stats.csv
+  ./drawing -S -c stats.csv input_$TEST_NO.txt output.pgm > stdout.txt 2> stderr.txt
+  if [ $? -ne 0 ] || [ -s stdout.txt ]
+  then
+      echo "**** Test $TEST_NO FAILED - couldn't draw with statistics"
+      FAIL=1
+      return 1
+  fi
+
+  diff -q expected_$TEST_NO.pgm output.pgm >/dev/null 2>&1
+  if [ $? -ne 0 ]
+  then
+      echo "**** Test $TEST_NO FAILED - output image doesn't match expected image"
+      FAIL=1
+      return 1
+  fi
+
+  head -n 1 stderr.txt | grep -q "^kind  *commands  *rejected  *clipped  *visited  *written  *hit%"
+  if [ $? -ne 0 ]
+  then
+      echo "**** Test $TEST_NO FAILED - summary doesn't start with its header"
+      FAIL=1
+      return 1
+  fi
+
+  COMMANDS=$( grep -c "[a-zA-Z]" input_$TEST_NO.txt )
+  awk -F, -v commands=$COMMANDS '
+    NR == 1 { ok = $0 == "line,kind,visited,written,ns,rejected,clipped"; next }
+    NF != 7 || $2 !~ /^(line|circle|rect|polygon)$/ || $3 < $4 { ok = 0 }
+    END { exit !( ok && NR == commands + 1 ) }' stats.csv
+  if [ $? -ne 0 ]
+  then
+      echo "**** Test $TEST_NO FAILED - CSV statistics don't have the right rows and columns"
+      FAIL=1
+      return 1
+  fi
+
+  echo "Test $TEST_NO PASS"
+  return 0
+}
+
 # Run each of the test cases
 runtest 1 0
 runtest 2 0
@@ -104,6 +304,28 @@ runtest 8 1
 runtest 9 1
 runtest 10 1
 runtest 11 1
+runtest 12 0 "-f p5"
+runtest 13 0 "-t -j 4"
+runtest 14 0 "-i tiny_1.pgm"
+runtest 15 0 "-f rle"
+runtest 16 0
+runtest 17 0
+runtest 18 1
+runtest 19 0 "-f p6 -j 3"
+runtest 20 0
+runtest 21 0 "-j 4"
+runtest 22 1 "-u -f png"
+runtest 23 0 "-f png"
+runtest 24 0 "-O"
+runtest 25 0 "-O -t -j 4"
+runcompiled 26 0
+runcompiled 27 1 4
+runupdate 28 "" expected_1.pgm
+runupdate 29 "-f p5" expected_12.pgm
+runupdate 30 "-f p5" expected_1.pgm
+runbatch 31 1
+runbatch 32 1
+runstats 33
 
 if [ $FAIL -ne 0 ]; then
   echo "FAILING TESTS!"